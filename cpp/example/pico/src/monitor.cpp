@@ -68,6 +68,9 @@ void monitor_update(uint16_t adc_val, vlcfg::Result error,
     char log_c;
     switch (pcs_symbol) {
       case vlcfg::SYMBOL_SOF: log_c = 's'; break;
+      case vlcfg::SYMBOL_SOF_FEC: log_c = 'f'; break;
+      case vlcfg::SYMBOL_PAM4: log_c = 'p'; break;
+      case vlcfg::SYMBOL_RATE: log_c = 'r'; break;
       case vlcfg::SYMBOL_EOF: log_c = 'e'; break;
       case vlcfg::SYMBOL_SYNC: log_c = 'y'; break;
       case vlcfg::SYMBOL_CTRL: log_c = '\\'; break;
@@ -54,6 +54,8 @@ void core0_main() {
   gpio_put(LED_PORT, false);
 
   receiver.init(configEntries);
+  receiver.decoder.set_auto_rearm(true);
+  receiver.decoder.set_frame_timeout_ms(60000);
 
   cyw43_arch_init_with_country(CYW43_COUNTRY_JAPAN);
   cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, false);
@@ -82,8 +84,10 @@ void core0_main() {
         if (rx_state == vlcfg::RxState::COMPLETED) {
           on_received();
           received = true;
-        } else if (rx_state == vlcfg::RxState::ERROR) {
-          received = true;
+        } else if (ret != vlcfg::Result::SUCCESS) {
+          // rearmed on the next update
+          printf("Error: %s, %d errors\r\n", vlcfg::result_to_string(ret),
+                 (int)receiver.decoder.get_counters().errors);
         }
       }
 
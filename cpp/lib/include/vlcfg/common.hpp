@@ -1,6 +1,7 @@
 #ifndef VLCFG_COMMON_HPP
 #define VLCFG_COMMON_HPP
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef VLBS_RX_BAUDRATE
@@ -75,6 +76,12 @@ int vlcfg_printf(const char* fmt, ...) {
     return __throw_ret;                                                  \
   } while (0)
 
+#if __cplusplus >= 201402L
+#define VLCFG_CONSTEXPR14 constexpr
+#else
+#define VLCFG_CONSTEXPR14 inline
+#endif
+
 #define VLCFG_TRY(x)                    \
   do {                                  \
     Result __try_ret = (x);             \
@@ -86,11 +93,37 @@ int vlcfg_printf(const char* fmt, ...) {
 namespace vlcfg {
 
 static constexpr uint8_t SYMBOL_BITS = 5;
+static constexpr uint8_t ADC_BITS = 12;
 
 static constexpr uint32_t RX_BIT_PERIOD_US = 1000000 / VLBS_RX_BAUDRATE;
 static constexpr uint32_t RX_SAMPLE_PERIOD_US =
     RX_BIT_PERIOD_US / VLBS_RX_SAMPLES_PER_BIT;
 
+static constexpr uint8_t MIN_SAMPLES_PER_BIT = 3;
+static constexpr uint8_t MAX_SAMPLES_PER_BIT = 32;
+
+struct RateConfig {
+  uint16_t baudrate;
+  uint8_t samples_per_bit;
+
+  inline constexpr uint32_t bit_period_us() const {
+    return 1000000 / baudrate;
+  }
+  inline constexpr uint32_t sample_period_us() const {
+    return bit_period_us() / samples_per_bit;
+  }
+};
+
+// Default rate for a receiver, the baudrate is scaled so that the sample
+// period stays at RX_SAMPLE_PERIOD_US when only the samples per bit is fixed.
+inline constexpr RateConfig default_rate_config(uint8_t samples_per_bit = 0) {
+  return (samples_per_bit == 0 || samples_per_bit == VLBS_RX_SAMPLES_PER_BIT)
+             ? RateConfig{VLBS_RX_BAUDRATE, VLBS_RX_SAMPLES_PER_BIT}
+             : RateConfig{(uint16_t)(1000000 / (RX_SAMPLE_PERIOD_US *
+                                                samples_per_bit)),
+                          samples_per_bit};
+}
+
 static constexpr uint8_t MAX_ENTRY_COUNT = 32;
 static constexpr uint8_t MAX_KEY_LEN = 16;
 
@@ -98,6 +131,9 @@ static constexpr int8_t SYMBOL_CTRL = -1;
 static constexpr int8_t SYMBOL_SYNC = -2;
 static constexpr int8_t SYMBOL_SOF = -3;
 static constexpr int8_t SYMBOL_EOF = -4;
+static constexpr int8_t SYMBOL_SOF_FEC = -5;
+static constexpr int8_t SYMBOL_PAM4 = -6;
+static constexpr int8_t SYMBOL_RATE = -7;
 static constexpr int8_t SYMBOL_NONE = -16;
 static constexpr int8_t SYMBOL_INVALID = -17;
 
@@ -108,18 +144,26 @@ enum class PcsState : uint8_t {
   RXED_SOF,
   RXED_BYTE,
   RXED_EOF,
+  // receiving the header of a dual-rate frame
+  RXED_RATE,
 };
 
 struct CdrOutput {
   bool signal_detected;
   bool rxed;
   bool rx_bit;
+  // reliability of rx_bit, 0 (at the threshold) to 255 (full swing)
+  uint8_t rx_conf;
 };
 
 struct PcsOutput {
   PcsState state;
   bool rxed;
   int16_t rx_byte;
+  // second most likely value of rx_byte and its cost margin, for the Chase
+  // decoding in RxDecoder (only with the soft decision in RxPcs)
+  uint8_t rx_alt;
+  uint8_t rx_margin;
 };
 
 enum class Result : uint8_t {
@@ -141,6 +185,11 @@ enum class Result : uint8_t {
   ERR_BAD_SHORT_COUNT,
   ERR_UNSUPPORTED_TYPE,
   ERR_BAD_CRC,
+  ERR_UNSUPPORTED_RATE,
+  ERR_BAD_FEC_HEADER,
+  ERR_BAD_LANE_HEADER,
+  ERR_TIMEOUT,
+  ERR_BAD_SEGMENT_HEADER,
 };
 
 enum class CborMajorType : uint8_t {
@@ -171,17 +220,49 @@ struct ConfigEntry {
   const char* key;
   void* buffer;
   ValueType type;
-  uint8_t capacity;
+  uint16_t capacity;
   uint8_t flags = 0;
-  uint8_t received = 0;
+  uint16_t received = 0;
 
   inline bool was_received() const { return (flags & ENTRY_RECEIVED) != 0; }
 };
 
+// 32 bit population count and bit scans, the builtins take an int, which is
+// 16 bit on AVR
+#if defined(__GNUC__) && !defined(__AVR__)
+static inline uint8_t popcount32(uint32_t x) { return __builtin_popcount(x); }
+static inline uint8_t ctz32(uint32_t x) { return __builtin_ctz(x); }
+static inline uint8_t clz32(uint32_t x) { return __builtin_clz(x); }
+#else
+static inline uint8_t popcount32(uint32_t x) {
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+static inline uint8_t ctz32(uint32_t x) { return popcount32((x & -x) - 1); }
+static inline uint8_t clz32(uint32_t x) {
+  x |= x >> 1;
+  x |= x >> 2;
+  x |= x >> 4;
+  x |= x >> 8;
+  x |= x >> 16;
+  return 32 - popcount32(x);
+}
+#endif
+
+// reverses the bit order of `x`
+static inline uint32_t reverse32(uint32_t x) {
+  x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+  x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+  x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+  x = ((x >> 8) & 0x00ff00ff) | ((x & 0x00ff00ff) << 8);
+  return (x >> 16) | (x << 16);
+}
+
 const char* result_to_string(Result res);
 int16_t find_key(const ConfigEntry* entries, const char* key);
 ConfigEntry* entry_from_key(ConfigEntry* entries, const char* key);
-uint32_t crc32(const uint8_t* data, uint16_t length);
 uint16_t median3(uint16_t a, uint16_t b, uint16_t c);
 
 #ifdef VLCFG_IMPLEMENTATION
@@ -198,6 +279,7 @@ const char* result_to_string(Result res) {
     case Result::ERR_VALUE_TYPE_MISMATCH: return "ERR_VALUE_TYPE_MISMATCH";
     case Result::ERR_BUFF_SIZE_MISMATCH: return "ERR_BUFF_SIZE_MISMATCH";
     case Result::ERR_VALUE_TOO_LONG: return "ERR_VALUE_TOO_LONG";
+    case Result::ERR_VALUE_OUT_OF_RANGE: return "ERR_VALUE_OUT_OF_RANGE";
     case Result::ERR_LOS: return "ERR_LOS";
     case Result::ERR_EOF_EXPECTED: return "ERR_EOF_EXPECTED";
     case Result::ERR_UNEXPECTED_EOF: return "ERR_UNEXPECTED_EOF";
@@ -205,6 +287,11 @@ const char* result_to_string(Result res) {
     case Result::ERR_BAD_SHORT_COUNT: return "ERR_BAD_SHORT_COUNT";
     case Result::ERR_UNSUPPORTED_TYPE: return "ERR_UNSUPPORTED_TYPE";
     case Result::ERR_BAD_CRC: return "ERR_BAD_CRC";
+    case Result::ERR_UNSUPPORTED_RATE: return "ERR_UNSUPPORTED_RATE";
+    case Result::ERR_BAD_FEC_HEADER: return "ERR_BAD_FEC_HEADER";
+    case Result::ERR_BAD_LANE_HEADER: return "ERR_BAD_LANE_HEADER";
+    case Result::ERR_TIMEOUT: return "ERR_TIMEOUT";
+    case Result::ERR_BAD_SEGMENT_HEADER: return "ERR_BAD_SEGMENT_HEADER";
     default: return "(Unknown Error)";
   }
 }
@@ -232,19 +319,6 @@ ConfigEntry* entry_from_key(ConfigEntry* entries, const char* key) {
   return &entries[index];
 }
 
-uint32_t crc32(const uint8_t* data, uint16_t length) {
-  uint32_t crc = 0xffffffff;
-  for (uint32_t i = 0; i < length; i++) {
-    uint8_t byte = data[i];
-    crc ^= byte;
-    for (uint8_t j = 0; j < 8; j++) {
-      uint32_t mask = -(crc & 1);
-      crc = (crc >> 1) ^ (0xedb88320 & mask);
-    }
-  }
-  return ~crc;
-}
-
 uint16_t median3(uint16_t a, uint16_t b, uint16_t c) {
   if (a > b) {
     if (b > c) {
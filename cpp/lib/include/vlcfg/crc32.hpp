@@ -0,0 +1,376 @@
+#ifndef VLCFG_CRC32_HPP
+#define VLCFG_CRC32_HPP
+
+#include "vlcfg/common.hpp"
+
+// Slicing tables of the CRC32: 8 for slice-by-8 (8 KiB), 4 for slice-by-4
+// (4 KiB), 0 for the 16-entry nibble table only. Needs C++14 constexpr to be
+// generated at compile time, and is disabled on AVR where const tables are
+// placed in RAM.
+#ifndef VLCFG_CRC_LUT
+#if (__cplusplus >= 201402L) && !defined(__AVR__)
+#define VLCFG_CRC_LUT (8)
+#else
+#define VLCFG_CRC_LUT (0)
+#endif
+#endif
+
+// PCLMULQDQ folding kernel for x86, used if the CPU supports it.
+#ifndef VLCFG_CRC_PCLMUL
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VLCFG_CRC_PCLMUL (1)
+#else
+#define VLCFG_CRC_PCLMUL (0)
+#endif
+#endif
+
+// ARMv8 CRC32 instructions, which use the same polynomial. Needs a target
+// with the CRC extension (e.g. -march=armv8-a+crc).
+#ifndef VLCFG_CRC_ARMV8
+#if defined(__ARM_FEATURE_CRC32)
+#define VLCFG_CRC_ARMV8 (1)
+#else
+#define VLCFG_CRC_ARMV8 (0)
+#endif
+#endif
+
+#ifdef VLCFG_IMPLEMENTATION
+#include <string.h>
+#if VLCFG_CRC_ARMV8
+#include <arm_acle.h>
+#endif
+#if VLCFG_CRC_PCLMUL
+#include <immintrin.h>
+#endif
+#endif
+
+namespace vlcfg {
+
+// CRC32 of the frames (IEEE 802.3, reflected polynomial 0xEDB88320).
+//
+// The state starts from 0xffffffff and the CRC is its complement.
+// crc32_update() feeds a block to the state with the kernel selected by
+// crc32_set_kernel(), by default the fastest one available: PCLMUL or ARMV8,
+// then the slicing tables, then the nibble table.
+enum class Crc32Kernel : uint8_t {
+  BITWISE,
+  NIBBLE,
+  SLICE4,
+  SLICE8,
+  ARMV8,
+  PCLMUL,
+};
+
+static constexpr uint32_t CRC32_POLY = 0xedb88320;
+
+uint32_t crc32(const uint8_t* data, size_t length);
+// Feeds one byte to the state.
+uint32_t crc32_update(uint32_t crc, uint8_t byte);
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t length);
+// Updates `*crc` with a specific kernel, ERR_VALUE_OUT_OF_RANGE if the kernel
+// is not supported.
+Result crc32_update(Crc32Kernel kernel, uint32_t* crc, const uint8_t* data,
+                    size_t length);
+bool crc32_kernel_supported(Crc32Kernel kernel);
+Result crc32_set_kernel(Crc32Kernel kernel);
+Crc32Kernel crc32_get_kernel();
+
+#ifdef VLCFG_IMPLEMENTATION
+
+static constexpr uint32_t CRC32_NIBBLE_TABLE[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+    0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+#if VLCFG_CRC_LUT
+// table[0] is the byte table, table[k] advances it by k more zero bytes
+struct Crc32Lut {
+  uint32_t table[VLCFG_CRC_LUT][256];
+  constexpr Crc32Lut() : table() {
+    for (uint16_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (uint8_t j = 0; j < 8; j++) {
+        c = (c & 1) ? (c >> 1) ^ CRC32_POLY : (c >> 1);
+      }
+      table[0][i] = c;
+    }
+    for (uint8_t k = 1; k < VLCFG_CRC_LUT; k++) {
+      for (uint16_t i = 0; i < 256; i++) {
+        const uint32_t c = table[k - 1][i];
+        table[k][i] = (c >> 8) ^ table[0][c & 0xff];
+      }
+    }
+  }
+};
+
+static constexpr Crc32Lut CRC32_LUT;
+#endif
+
+typedef uint32_t (*Crc32Func)(uint32_t crc, const uint8_t* data,
+                              size_t length);
+
+static inline uint32_t load_le32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static uint32_t crc32_bitwise(uint32_t crc, const uint8_t* data,
+                              size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t j = 0; j < 8; j++) {
+      uint32_t mask = -(crc & 1);
+      crc = (crc >> 1) ^ (CRC32_POLY & mask);
+    }
+  }
+  return crc;
+}
+
+static uint32_t crc32_nibble(uint32_t crc, const uint8_t* data,
+                             size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ CRC32_NIBBLE_TABLE[crc & 0xf];
+    crc = (crc >> 4) ^ CRC32_NIBBLE_TABLE[crc & 0xf];
+  }
+  return crc;
+}
+
+#if VLCFG_CRC_LUT >= 4
+static uint32_t crc32_slice4(uint32_t crc, const uint8_t* data,
+                             size_t length) {
+  const uint32_t(*t)[256] = CRC32_LUT.table;
+  for (; length >= 4; data += 4, length -= 4) {
+    crc ^= load_le32(data);
+    crc = t[3][crc & 0xff] ^ t[2][(crc >> 8) & 0xff] ^
+          t[1][(crc >> 16) & 0xff] ^ t[0][crc >> 24];
+  }
+  for (; length > 0; length--) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+  }
+  return crc;
+}
+#endif
+
+#if VLCFG_CRC_LUT >= 8
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t* data,
+                             size_t length) {
+  const uint32_t(*t)[256] = CRC32_LUT.table;
+  for (; length >= 8; data += 8, length -= 8) {
+    const uint32_t a = crc ^ load_le32(data);
+    const uint32_t b = load_le32(data + 4);
+    crc = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^ t[5][(a >> 16) & 0xff] ^
+          t[4][a >> 24] ^ t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^
+          t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+  }
+  return crc32_slice4(crc, data, length);
+}
+#endif
+
+// the fastest table kernel, also used for the tails of the PCLMUL kernel
+#if VLCFG_CRC_LUT >= 8
+static constexpr Crc32Kernel CRC32_TABLE_KERNEL = Crc32Kernel::SLICE8;
+static constexpr Crc32Func crc32_table = crc32_slice8;
+#elif VLCFG_CRC_LUT >= 4
+static constexpr Crc32Kernel CRC32_TABLE_KERNEL = Crc32Kernel::SLICE4;
+static constexpr Crc32Func crc32_table = crc32_slice4;
+#else
+static constexpr Crc32Kernel CRC32_TABLE_KERNEL = Crc32Kernel::NIBBLE;
+static constexpr Crc32Func crc32_table = crc32_nibble;
+#endif
+
+#if VLCFG_CRC_ARMV8
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t* data,
+                            size_t length) {
+  for (; length > 0 && ((uintptr_t)data & 7); length--) {
+    crc = __crc32b(crc, *data++);
+  }
+  for (; length >= 8; data += 8, length -= 8) {
+    uint64_t w;
+    memcpy(&w, data, sizeof(w));
+    crc = __crc32d(crc, w);
+  }
+  for (; length > 0; length--) {
+    crc = __crc32b(crc, *data++);
+  }
+  return crc;
+}
+#endif
+
+#if VLCFG_CRC_PCLMUL
+// Folds 64 bytes at a time with carry-less multiplications and reduces the
+// remainder with the Barrett reduction, after "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009). The
+// constants are x^n mod P(x), bit reflected.
+__attribute__((target("pclmul,sse4.1"))) static uint32_t crc32_pclmul(
+    uint32_t crc, const uint8_t* data, size_t length) {
+  if (length < 64) return crc32_table(crc, data, length);
+
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+  __m128i x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+  __m128i x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+  __m128i x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+  __m128i x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  data += 64;
+  length -= 64;
+
+  // four lanes of 16 bytes
+  for (; length >= 64; data += 64, length -= 64) {
+    __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                       _mm_loadu_si128((const __m128i*)(data + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                       _mm_loadu_si128((const __m128i*)(data + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                       _mm_loadu_si128((const __m128i*)(data + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                       _mm_loadu_si128((const __m128i*)(data + 0x30)));
+  }
+
+  // folds the lanes into one, then the rest 16 bytes at a time
+  const __m128i lanes[3] = {x2, x3, x4};
+  for (uint8_t i = 0; i < 3; i++) {
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), lanes[i]);
+  }
+  for (; length >= 16; data += 16, length -= 16) {
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                       _mm_loadu_si128((const __m128i*)data));
+  }
+
+  // 128 bits to 64 bits
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  crc = _mm_extract_epi32(x1, 1);
+
+  return crc32_table(crc, data, length);
+}
+#endif
+
+static Crc32Func crc32_func_of(Crc32Kernel kernel) {
+  switch (kernel) {
+    case Crc32Kernel::BITWISE: return crc32_bitwise;
+    case Crc32Kernel::NIBBLE: return crc32_nibble;
+#if VLCFG_CRC_LUT >= 4
+    case Crc32Kernel::SLICE4: return crc32_slice4;
+#endif
+#if VLCFG_CRC_LUT >= 8
+    case Crc32Kernel::SLICE8: return crc32_slice8;
+#endif
+#if VLCFG_CRC_ARMV8
+    case Crc32Kernel::ARMV8: return crc32_armv8;
+#endif
+#if VLCFG_CRC_PCLMUL
+    case Crc32Kernel::PCLMUL:
+      if (__builtin_cpu_supports("pclmul") &&
+          __builtin_cpu_supports("sse4.1")) {
+        return crc32_pclmul;
+      }
+      return nullptr;
+#endif
+    default: return nullptr;
+  }
+}
+
+static uint32_t crc32_resolve(uint32_t crc, const uint8_t* data,
+                              size_t length);
+
+// selected on the first call
+static Crc32Kernel crc32_kernel = CRC32_TABLE_KERNEL;
+static Crc32Func crc32_func = crc32_resolve;
+
+static uint32_t crc32_resolve(uint32_t crc, const uint8_t* data,
+                              size_t length) {
+  static const Crc32Kernel preferred[] = {Crc32Kernel::PCLMUL,
+                                          Crc32Kernel::ARMV8};
+  crc32_kernel = CRC32_TABLE_KERNEL;
+  for (uint8_t i = 0; i < sizeof(preferred) / sizeof(preferred[0]); i++) {
+    if (crc32_func_of(preferred[i])) {
+      crc32_kernel = preferred[i];
+      break;
+    }
+  }
+  crc32_func = crc32_func_of(crc32_kernel);
+  return crc32_func(crc, data, length);
+}
+
+uint32_t crc32(const uint8_t* data, size_t length) {
+  return ~crc32_func(0xffffffff, data, length);
+}
+
+uint32_t crc32_update(uint32_t crc, uint8_t byte) {
+#if VLCFG_CRC_ARMV8
+  return __crc32b(crc, byte);
+#elif VLCFG_CRC_LUT
+  return (crc >> 8) ^ CRC32_LUT.table[0][(crc ^ byte) & 0xff];
+#else
+  return crc32_nibble(crc, &byte, 1);
+#endif
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t length) {
+  return crc32_func(crc, data, length);
+}
+
+Result crc32_update(Crc32Kernel kernel, uint32_t* crc, const uint8_t* data,
+                    size_t length) {
+  if (crc == nullptr) {
+    VLCFG_THROW(Result::ERR_NULL_POINTER);
+  }
+  Crc32Func func = crc32_func_of(kernel);
+  if (func == nullptr) {
+    VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+  }
+  *crc = func(*crc, data, length);
+  return Result::SUCCESS;
+}
+
+bool crc32_kernel_supported(Crc32Kernel kernel) {
+  return crc32_func_of(kernel) != nullptr;
+}
+
+Result crc32_set_kernel(Crc32Kernel kernel) {
+  Crc32Func func = crc32_func_of(kernel);
+  if (func == nullptr) {
+    VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+  }
+  crc32_kernel = kernel;
+  crc32_func = func;
+  return Result::SUCCESS;
+}
+
+Crc32Kernel crc32_get_kernel() {
+  if (crc32_func == crc32_resolve) crc32_resolve(0, nullptr, 0);
+  return crc32_kernel;
+}
+
+#endif
+
+}  // namespace vlcfg
+
+#endif
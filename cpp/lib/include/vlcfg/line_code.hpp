@@ -0,0 +1,273 @@
+#ifndef VLCFG_LINE_CODE_HPP
+#define VLCFG_LINE_CODE_HPP
+
+#include "vlcfg/common.hpp"
+
+// Lookup table of the codewords. Needs C++14 constexpr to be generated at
+// compile time, and is disabled on AVR where const tables are placed in RAM.
+#ifndef VLCFG_PCS_LUT
+#if (__cplusplus >= 201402L) && !defined(__AVR__)
+#define VLCFG_PCS_LUT (1)
+#else
+#define VLCFG_PCS_LUT (0)
+#endif
+#endif
+
+namespace vlcfg {
+
+// A line code is a policy class of RxPcsT. It maps each byte to a codeword of
+// CODE_BITS bits with encode(), and defines the control codewords SYNC_WORD,
+// SOF_WORD, SOF_FEC_WORD, EOF_WORD, PAM4_WORD and RATE_WORD. The decode table
+// is generated from them. CODE_ID identifies the line code in the header of
+// the dual-rate frames.
+//
+// nearest() is the soft decision: the nearest and second nearest byte to the
+// codeword `rxed` weighted by the bit confidences (`conf[0]` for the LSB).
+// debug_symbol() is the symbol shown by RxPcsT::dbg_rxed_symbol when bit
+// `phase` of a codeword is received.
+
+// sum of the confidences of the bits that differ
+static inline uint16_t codeword_cost(uint16_t rxed, uint16_t code,
+                                     uint8_t bits, const uint8_t *conf) {
+  uint16_t diff = rxed ^ code;
+  uint16_t cost = 0;
+  for (uint8_t i = 0; i < bits; i++) {
+    if (diff & (1 << i)) cost += conf[i];
+  }
+  return cost;
+}
+
+static constexpr int8_t DECODE_4B5B[1 << SYMBOL_BITS] = {
+    SYMBOL_INVALID,  // 0b00000
+    SYMBOL_INVALID,  // 0b00001
+    SYMBOL_INVALID,  // 0b00010
+    SYMBOL_SOF,      // 0b00011
+    SYMBOL_INVALID,  // 0b00100
+    0x0,             // 0b00101
+    0x1,             // 0b00110
+    SYMBOL_EOF,      // 0b00111
+    SYMBOL_INVALID,  // 0b01000
+    0x2,             // 0b01001
+    SYMBOL_CTRL,     // 0b01010
+    0x3,             // 0b01011
+    0x4,             // 0b01100
+    0x5,             // 0b01101
+    0x6,             // 0b01110
+    SYMBOL_INVALID,  // 0b01111
+    SYMBOL_INVALID,  // 0b10000
+    SYMBOL_SYNC,     // 0b10001
+    0x7,             // 0b10010
+    0x8,             // 0b10011
+    0x9,             // 0b10100
+    0xA,             // 0b10101
+    0xB,             // 0b10110
+    SYMBOL_RATE,     // 0b10111
+    0xC,             // 0b11000
+    0xD,             // 0b11001
+    0xE,             // 0b11010
+    SYMBOL_SOF_FEC,  // 0b11011
+    0xF,             // 0b11100
+    SYMBOL_PAM4,     // 0b11101
+    SYMBOL_INVALID,  // 0b11110
+    SYMBOL_INVALID,  // 0b11111
+};
+
+static constexpr uint8_t ENCODE_4B5B[16] = {
+    0b00101, 0b00110, 0b01001, 0b01011, 0b01100, 0b01101, 0b01110, 0b10010,
+    0b10011, 0b10100, 0b10101, 0b10110, 0b11000, 0b11001, 0b11010, 0b11100,
+};
+
+// 4b/5b: each nibble is a 5 bit symbol, the upper one first, and a control
+// codeword is CTRL followed by a control symbol. 80% efficiency, runs of up
+// to 5 bits.
+struct LineCode4b5b {
+  static constexpr uint8_t CODE_ID = 0;
+  static constexpr uint8_t CODE_BITS = SYMBOL_BITS * 2;
+  static constexpr uint8_t CTRL_CODE = 0b01010;
+  static constexpr uint16_t SYNC_WORD = (CTRL_CODE << SYMBOL_BITS) | 0b10001;
+  static constexpr uint16_t SOF_WORD = (CTRL_CODE << SYMBOL_BITS) | 0b00011;
+  static constexpr uint16_t SOF_FEC_WORD = (CTRL_CODE << SYMBOL_BITS) | 0b11011;
+  static constexpr uint16_t EOF_WORD = (CTRL_CODE << SYMBOL_BITS) | 0b00111;
+  static constexpr uint16_t PAM4_WORD = (CTRL_CODE << SYMBOL_BITS) | 0b11101;
+  static constexpr uint16_t RATE_WORD = (CTRL_CODE << SYMBOL_BITS) | 0b10111;
+
+  static constexpr uint16_t encode(uint8_t byte) {
+    return (ENCODE_4B5B[byte >> 4] << SYMBOL_BITS) | ENCODE_4B5B[byte & 0xf];
+  }
+
+  // Decodes a pair of symbols to a byte, SYMBOL_SYNC, SYMBOL_SOF,
+  // SYMBOL_SOF_FEC, SYMBOL_EOF, SYMBOL_PAM4, SYMBOL_RATE or SYMBOL_INVALID,
+  // without the lookup table.
+  static VLCFG_CONSTEXPR14 int16_t decode(uint16_t codeword) {
+    const int8_t h = DECODE_4B5B[(codeword >> SYMBOL_BITS) & 0x1f];
+    const int8_t l = DECODE_4B5B[codeword & 0x1f];
+    if (h >= 0 && l >= 0) return (h << 4) | l;
+    if (h == SYMBOL_CTRL && (l == SYMBOL_SYNC || l == SYMBOL_SOF ||
+                             l == SYMBOL_EOF || l == SYMBOL_SOF_FEC ||
+                             l == SYMBOL_PAM4 || l == SYMBOL_RATE)) {
+      return l;
+    }
+    return SYMBOL_INVALID;
+  }
+
+  static uint8_t nearest(uint16_t rxed, const uint8_t *conf, uint16_t *cost,
+                         uint8_t *alt, uint16_t *margin);
+
+  // each symbol
+  static inline int8_t debug_symbol(uint16_t shift_reg, uint8_t phase) {
+    if (phase != SYMBOL_BITS - 1 && phase != CODE_BITS - 1) return SYMBOL_NONE;
+    return DECODE_4B5B[shift_reg & 0x1f];
+  }
+};
+
+#if VLCFG_PCS_LUT
+static constexpr uint8_t CODE_8B9B_MAX_EDGE_RUN = 2;
+static constexpr uint8_t CODE_8B9B_MAX_RUN = 4;
+
+// Encoder table of LineCode8b9b: the first 256 9 bit words in ascending
+// order whose runs are up to CODE_8B9B_MAX_EDGE_RUN bits at both ends and up
+// to CODE_8B9B_MAX_RUN bits inside.
+struct Code8b9bTable {
+  uint16_t table[256];
+  constexpr Code8b9bTable() : table() {
+    uint16_t n = 0;
+    for (uint16_t w = 0; w < 512 && n < 256; w++) {
+      uint8_t run = 1, first = 0, longest = 1;
+      for (uint8_t i = 1; i < 9; i++) {
+        if (((w >> i) & 1) == ((w >> (i - 1)) & 1)) {
+          run++;
+        } else {
+          if (first == 0) first = run;
+          run = 1;
+        }
+        if (run > longest) longest = run;
+      }
+      if (first == 0) first = run;
+      if (first <= CODE_8B9B_MAX_EDGE_RUN && run <= CODE_8B9B_MAX_EDGE_RUN &&
+          longest <= CODE_8B9B_MAX_RUN) {
+        table[n++] = w;
+      }
+    }
+  }
+};
+
+static constexpr Code8b9bTable CODE_8B9B_TABLE;
+
+// 8b/9b: each byte is a single 9 bit codeword, 89% efficiency. The data runs
+// are up to 4 bits even across the codewords. Each control codeword has a run
+// of 5 bits, which never appears in the data, so SYNC is only found at the
+// codeword boundary. Needs the lookup table (C++14).
+struct LineCode8b9b {
+  static constexpr uint8_t CODE_ID = 1;
+  static constexpr uint8_t CODE_BITS = 9;
+  static constexpr uint16_t SYNC_WORD = 0b100000101;
+  static constexpr uint16_t SOF_WORD = 0b010000011;
+  static constexpr uint16_t SOF_FEC_WORD = 0b001111101;
+  static constexpr uint16_t EOF_WORD = 0b011111010;
+  static constexpr uint16_t PAM4_WORD = 0b101111100;
+  static constexpr uint16_t RATE_WORD = 0b000111110;
+
+  static constexpr uint16_t encode(uint8_t byte) {
+    return CODE_8B9B_TABLE.table[byte];
+  }
+
+  static uint8_t nearest(uint16_t rxed, const uint8_t *conf, uint16_t *cost,
+                         uint8_t *alt, uint16_t *margin);
+
+  // control codewords only
+  static inline int8_t debug_symbol(uint16_t shift_reg, uint8_t phase) {
+    if (phase != CODE_BITS - 1) return SYMBOL_NONE;
+    switch (shift_reg & 0x1ff) {
+      case SYNC_WORD: return SYMBOL_SYNC;
+      case SOF_WORD: return SYMBOL_SOF;
+      case SOF_FEC_WORD: return SYMBOL_SOF_FEC;
+      case EOF_WORD: return SYMBOL_EOF;
+      case PAM4_WORD: return SYMBOL_PAM4;
+      case RATE_WORD: return SYMBOL_RATE;
+      default: return SYMBOL_NONE;
+    }
+  }
+};
+#endif
+
+#ifdef VLCFG_IMPLEMENTATION
+
+// nearest and second nearest data symbol
+static uint8_t nearest_nibble(uint8_t rxed, const uint8_t *conf,
+                              uint16_t *cost, uint8_t *alt,
+                              uint16_t *margin) {
+  uint8_t best = 0, second = 0;
+  uint16_t best_cost = 0xffff, second_cost = 0xffff;
+  for (uint8_t i = 0; i < 16; i++) {
+    uint16_t c = codeword_cost(rxed, ENCODE_4B5B[i], SYMBOL_BITS, conf);
+    // prefer the symbol as received on a tie
+    if (c < best_cost || (c == best_cost && ENCODE_4B5B[i] == rxed)) {
+      second = best;
+      second_cost = best_cost;
+      best = i;
+      best_cost = c;
+    } else if (c < second_cost) {
+      second = i;
+      second_cost = c;
+    }
+  }
+  *cost = best_cost;
+  *alt = second;
+  *margin = second_cost - best_cost;
+  return best;
+}
+
+// The cost is the sum of the symbols, so the nibbles are searched separately
+// and the alternative replaces the less reliable one.
+uint8_t LineCode4b5b::nearest(uint16_t rxed, const uint8_t *conf,
+                              uint16_t *cost, uint8_t *alt,
+                              uint16_t *margin) {
+  const uint8_t sym_h = (rxed >> SYMBOL_BITS) & 0x1f;
+  const uint8_t sym_l = rxed & 0x1f;
+  uint16_t cost_h, cost_l, margin_h, margin_l;
+  uint8_t alt_h, alt_l;
+  uint8_t nibble_h =
+      nearest_nibble(sym_h, conf + SYMBOL_BITS, &cost_h, &alt_h, &margin_h);
+  uint8_t nibble_l = nearest_nibble(sym_l, conf, &cost_l, &alt_l, &margin_l);
+  *cost = cost_h + cost_l;
+  if (margin_h < margin_l) {
+    *alt = (alt_h << 4) | nibble_l;
+    *margin = margin_h;
+  } else {
+    *alt = (nibble_h << 4) | alt_l;
+    *margin = margin_l;
+  }
+  return (nibble_h << 4) | nibble_l;
+}
+
+#if VLCFG_PCS_LUT
+uint8_t LineCode8b9b::nearest(uint16_t rxed, const uint8_t *conf,
+                              uint16_t *cost, uint8_t *alt,
+                              uint16_t *margin) {
+  uint8_t best = 0, second = 0;
+  uint16_t best_cost = 0xffff, second_cost = 0xffff;
+  for (uint16_t i = 0; i < 256; i++) {
+    const uint16_t code = encode(i);
+    uint16_t c = codeword_cost(rxed, code, CODE_BITS, conf);
+    if (c < best_cost || (c == best_cost && code == rxed)) {
+      second = best;
+      second_cost = best_cost;
+      best = i;
+      best_cost = c;
+    } else if (c < second_cost) {
+      second = i;
+      second_cost = c;
+    }
+  }
+  *cost = best_cost;
+  *alt = second;
+  *margin = second_cost - best_cost;
+  return best;
+}
+#endif
+
+#endif
+
+}  // namespace vlcfg
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef VLCFG_MULTI_LANE_RECEIVER_HPP
+#define VLCFG_MULTI_LANE_RECEIVER_HPP
+
+#include "vlcfg/common.hpp"
+#include "vlcfg/rx_cdr.hpp"
+#include "vlcfg/rx_decoder.hpp"
+#include "vlcfg/rx_lanes.hpp"
+#include "vlcfg/rx_pcs.hpp"
+
+namespace vlcfg {
+
+// Receiver for a frame striped across LANES lamps (screen regions or color
+// channels), with one sensor per lane. Each lane has its own CDR and PCS,
+// and the lanes are merged into a single decoder.
+template <uint8_t LANES, uint8_t SAMPLES_PER_BIT = 0,
+          class LINE_CODE = LineCode4b5b>
+class MultiLaneReceiverT {
+  static_assert(1 <= LANES && LANES <= MAX_LANES,
+                "LANES must be 1 to MAX_LANES.");
+
+ public:
+  RxCdrT<SAMPLES_PER_BIT> cdr[LANES];
+  RxPcsT<LINE_CODE> pcs[LANES];
+  RxLaneMerger merger;
+  RxDecoder decoder;
+
+  inline MultiLaneReceiverT(int rx_buff_size = 256,
+                            ConfigEntry *entries = nullptr)
+      : decoder(rx_buff_size) {
+    init(entries);
+  }
+
+  inline MultiLaneReceiverT(int rx_buff_size, ConfigEntry *entries,
+                            const RateConfig &rate)
+      : decoder(rx_buff_size) {
+    set_rate(rate);
+    init(entries);
+  }
+
+  void init(ConfigEntry *entries);
+  Result set_rate(const RateConfig &rate);
+  inline const RateConfig &get_rate() const { return cdr[0].get_rate(); }
+  inline uint32_t sample_period_us() const {
+    return cdr[0].sample_period_us();
+  }
+  // Takes one sample of each sensor, `samples[i]` from sensor `i`.
+  Result update(const uint16_t *samples, RxState *rx_state);
+
+  // Receives the PAM-4 frames, see RxCdrT::set_pam4().
+  inline void set_pam4(bool enable) {
+    for (uint8_t i = 0; i < LANES; i++) cdr[i].set_pam4(enable);
+  }
+
+  inline bool signal_detected(uint8_t input) const {
+    return input < LANES && cdr[input].signal_detected();
+  }
+  inline PcsState get_pcs_state(uint8_t input) const {
+    return pcs[input].get_state();
+  }
+  inline RxState get_decoder_state() const {
+    return merger.get_state(decoder);
+  }
+
+  inline ConfigEntry *entry_from_key(const char *key) const {
+    return decoder.entry_from_key(key);
+  }
+};  // class
+
+template <uint8_t LANES>
+using MultiLaneReceiver = MultiLaneReceiverT<LANES>;
+
+template <uint8_t LANES, uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+void MultiLaneReceiverT<LANES, SAMPLES_PER_BIT, LINE_CODE>::init(
+    ConfigEntry *entries) {
+  for (uint8_t i = 0; i < LANES; i++) {
+    cdr[i].init();
+    pcs[i].init();
+  }
+  merger.init(LANES);
+  decoder.init(entries);
+  VLCFG_PRINTF("Multi-lane receiver initialized.\n");
+}
+
+template <uint8_t LANES, uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+Result MultiLaneReceiverT<LANES, SAMPLES_PER_BIT, LINE_CODE>::set_rate(
+    const RateConfig &rate) {
+  for (uint8_t i = 0; i < LANES; i++) {
+    VLCFG_TRY(cdr[i].set_rate(rate));
+  }
+  return Result::SUCCESS;
+}
+
+template <uint8_t LANES, uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+Result MultiLaneReceiverT<LANES, SAMPLES_PER_BIT, LINE_CODE>::update(
+    const uint16_t *samples, RxState *rx_state) {
+  if (samples == nullptr) {
+    VLCFG_THROW(Result::ERR_NULL_POINTER);
+  }
+
+  // the merger keeps its error state, so both are rearmed here
+  if (decoder.get_auto_rearm() && get_decoder_state() == RxState::ERROR) {
+    VLCFG_PRINTF("Multi-lane receiver rearmed.\n");
+    merger.init(LANES);
+    decoder.rearm();
+  }
+
+  for (uint8_t i = 0; i < LANES; i++) {
+    CdrOutput cdrOut;
+    VLCFG_TRY(cdr[i].update(samples[i], &cdrOut));
+
+    PcsOutput pcsOut;
+    VLCFG_TRY(pcs[i].update(&cdrOut, &pcsOut));
+    pam4_control(cdr[i], pcsOut);
+    VLCFG_TRY(dual_rate_control(cdr[i], pcs[i], pcsOut));
+
+    const RxState last_state = decoder.get_state();
+    Result ret = merger.update(i, &pcsOut, decoder, rx_state);
+    // the decoder counts its own errors
+    if (ret != Result::SUCCESS && decoder.get_state() == last_state) {
+      decoder.count_error(ret);
+    }
+    VLCFG_TRY(ret);
+  }
+  if (get_decoder_state() != RxState::ERROR) {
+    VLCFG_TRY(decoder.update_timer(sample_period_us(), rx_state));
+  }
+  return Result::SUCCESS;
+}
+
+}  // namespace vlcfg
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef VLCFG_PACKED_RECEIVER_HPP
+#define VLCFG_PACKED_RECEIVER_HPP
+
+#include "vlcfg/common.hpp"
+#include "vlcfg/rx_decoder.hpp"
+#include "vlcfg/rx_packed.hpp"
+#include "vlcfg/rx_pcs.hpp"
+
+namespace vlcfg {
+
+// Receiver for 1-bit digital input packed into 32 bit words. LINE_CODE
+// selects the line code (line_code.hpp).
+template <class LINE_CODE = LineCode4b5b>
+class PackedReceiverT {
+ public:
+  RxPackedCdr cdr;
+  RxPcsT<LINE_CODE> pcs;
+  RxDecoder decoder;
+
+ private:
+  bool last_bit;
+  uint8_t last_byte;
+
+ public:
+  inline PackedReceiverT(int rx_buff_size = 256,
+                         ConfigEntry *entries = nullptr)
+      : decoder(rx_buff_size) {
+    init(entries);
+  }
+
+  inline PackedReceiverT(int rx_buff_size, ConfigEntry *entries,
+                         const RateConfig &rate)
+      : decoder(rx_buff_size) {
+    cdr.set_rate(rate);
+    init(entries);
+  }
+
+  void init(ConfigEntry *entries);
+  inline Result set_rate(const RateConfig &rate) { return cdr.set_rate(rate); }
+  inline const RateConfig &get_rate() const { return cdr.get_rate(); }
+  inline uint32_t sample_period_us() const {
+    return cdr.get_rate().sample_period_us();
+  }
+  Result update(uint32_t word, RxState *rx_state);
+  Result update_block(const uint32_t *words, size_t n, RxState *rx_state,
+                      size_t *consumed = nullptr);
+
+  inline bool signal_detected() const { return cdr.signal_detected(); }
+  inline PcsState get_pcs_state() const { return pcs.get_state(); }
+  inline RxState get_decoder_state() const { return decoder.get_state(); }
+
+  inline bool get_last_bit() const { return last_bit; }
+  inline uint8_t get_last_byte() const { return last_byte; }
+
+  inline ConfigEntry *entry_from_key(const char *key) const {
+    return decoder.entry_from_key(key);
+  }
+};  // class
+
+using PackedReceiver = PackedReceiverT<>;
+
+template <class LINE_CODE>
+void PackedReceiverT<LINE_CODE>::init(ConfigEntry *entries) {
+  cdr.init();
+  pcs.init();
+  decoder.init(entries);
+  VLCFG_PRINTF("Packed receiver initialized.\n");
+}
+
+// Processes 32 samples, the oldest one in the LSB.
+template <class LINE_CODE>
+Result PackedReceiverT<LINE_CODE>::update(uint32_t word, RxState *rx_state) {
+  PackedCdrOutput cdrOut;
+  VLCFG_TRY(cdr.update(word, &cdrOut));
+
+  PcsOutput pcsOut;
+  uint8_t pos = 0;
+  while (pos < cdrOut.num_bits) {
+    uint8_t used;
+    VLCFG_TRY(pcs.update_bits(cdrOut.rx_bits >> pos, cdrOut.num_bits - pos,
+                              cdrOut.rx_conf + pos, &pcsOut, &used));
+    pos += used;
+    if (pcsOut.rxed) last_byte = pcsOut.rx_byte;
+    VLCFG_TRY(decoder.update(&pcsOut, rx_state));
+  }
+  if (cdrOut.num_bits > 0) {
+    last_bit = (cdrOut.rx_bits >> (cdrOut.num_bits - 1)) & 1;
+  }
+
+  // let the PCS know the loss of signal
+  CdrOutput bitOut;
+  bitOut.signal_detected = cdrOut.signal_detected;
+  bitOut.rxed = false;
+  VLCFG_TRY(pcs.update(&bitOut, &pcsOut));
+  VLCFG_TRY(decoder.update(&pcsOut, rx_state));
+  VLCFG_TRY(decoder.update_timer(sample_period_us() * 32, rx_state));
+
+  return Result::SUCCESS;
+}
+
+// Processes a block of words. Returns early when the signal is acquired or
+// lost, or when the decoder state changes, like ReceiverT::update_block().
+template <class LINE_CODE>
+Result PackedReceiverT<LINE_CODE>::update_block(const uint32_t *words,
+                                                size_t n, RxState *rx_state,
+                                                size_t *consumed) {
+  if (words == nullptr && n > 0) {
+    VLCFG_THROW(Result::ERR_NULL_POINTER);
+  }
+
+  const RxState last_state = decoder.get_state();
+  if (rx_state) *rx_state = last_state;
+
+  size_t pos = 0;
+  while (pos < n) {
+    const bool last_sig_det = cdr.signal_detected();
+    Result ret = update(words[pos++], rx_state);
+    if (ret != Result::SUCCESS) {
+      if (consumed) *consumed = pos;
+      VLCFG_THROW(ret);
+    }
+    if (cdr.signal_detected() != last_sig_det) break;
+    if (decoder.get_state() != last_state) break;
+  }
+
+  if (consumed) *consumed = pos;
+  return Result::SUCCESS;
+}
+
+}  // namespace vlcfg
+
+#endif
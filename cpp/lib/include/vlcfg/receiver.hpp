@@ -8,26 +8,71 @@
 
 namespace vlcfg {
 
-class Receiver {
+// amplitude detection windows without signal before the squelch closes
+static constexpr uint8_t SQUELCH_HANG_WINDOWS = 2;
+
+// SAMPLES_PER_BIT fixes the CDR oversampling ratio at compile time, 0 selects
+// a runtime-configured rate. LINE_CODE selects the line code (line_code.hpp).
+template <uint8_t SAMPLES_PER_BIT = 0, class LINE_CODE = LineCode4b5b>
+class ReceiverT {
  public:
-  RxCdr cdr;
-  RxPcs pcs;
+  RxCdrT<SAMPLES_PER_BIT> cdr;
+  RxPcsT<LINE_CODE> pcs;
   RxDecoder decoder;
 
  private:
   bool last_bit;
   uint8_t last_byte;
+  bool squelch = false;
+  uint8_t idle_decimation = 1;
+  bool squelch_open;
+  uint16_t squelch_slots;
+  uint16_t squelch_max;
+  uint16_t squelch_min;
 
  public:
-  inline Receiver(int rx_buff_size = 256, ConfigEntry *entries = nullptr)
+  inline ReceiverT(int rx_buff_size = 256, ConfigEntry *entries = nullptr)
+      : decoder(rx_buff_size) {
+    init(entries);
+  }
+
+  inline ReceiverT(int rx_buff_size, ConfigEntry *entries,
+                   const RateConfig &rate)
       : decoder(rx_buff_size) {
+    cdr.set_rate(rate);
     init(entries);
   }
 
   void init(ConfigEntry *entries);
+  inline Result set_rate(const RateConfig &rate) { return cdr.set_rate(rate); }
+  inline const RateConfig &get_rate() const { return cdr.get_rate(); }
+  inline uint32_t sample_period_us() const { return cdr.sample_period_us(); }
   Result update(uint16_t adc_val, RxState *rx_state);
+  Result update(uint16_t adc_val, uint32_t timestamp_us, RxState *rx_state);
+  Result update_block(const uint16_t *samples, size_t n, RxState *rx_state,
+                      size_t *consumed = nullptr);
 
   inline bool signal_detected() const { return cdr.signal_detected(); }
+
+  // Receives the PAM-4 frames, see RxCdrT::set_pam4().
+  inline void set_pam4(bool enable) { cdr.set_pam4(enable); }
+  inline bool get_pam4() const { return cdr.get_pam4(); }
+
+  // Keeps the CDR, PCS and decoder idle and only checks the swing of the
+  // samples until it reaches the amplitude gate.
+  void set_squelch(bool enable);
+  inline bool get_squelch() const { return squelch; }
+  // Sampling interval multiplier while the squelch is closed.
+  Result set_idle_decimation(uint8_t decimation);
+  inline uint8_t get_idle_decimation() const { return idle_decimation; }
+  inline bool squelch_is_open() const { return squelch_open; }
+  // Interval to the next sample, sample_period_us() times the idle decimation
+  // while the squelch is closed.
+  inline uint32_t current_sample_period_us() const {
+    return squelch_open ? sample_period_us()
+                        : sample_period_us() * idle_decimation;
+  }
+
   inline PcsState get_pcs_state() const { return pcs.get_state(); }
   inline RxState get_decoder_state() const { return decoder.get_state(); }
 
@@ -37,18 +82,48 @@ class Receiver {
   inline ConfigEntry *entry_from_key(const char *key) const {
     return decoder.entry_from_key(key);
   }
+
+ private:
+  bool squelch_step(uint16_t adc_val);
+  void squelch_hang(uint32_t slots);
+  void close_squelch();
 };  // class
 
-#ifdef VLCFG_IMPLEMENTATION
+using Receiver = ReceiverT<>;
 
-void Receiver::init(ConfigEntry *entries) {
+template <uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+void ReceiverT<SAMPLES_PER_BIT, LINE_CODE>::init(ConfigEntry *entries) {
   cdr.init();
   pcs.init();
   decoder.init(entries);
+  close_squelch();
   VLCFG_PRINTF("Receiver initialized.\n");
 }
 
-Result Receiver::update(uint16_t adc_val, RxState *rx_state) {
+template <uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+void ReceiverT<SAMPLES_PER_BIT, LINE_CODE>::set_squelch(bool enable) {
+  squelch = enable;
+  close_squelch();
+}
+
+template <uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+Result ReceiverT<SAMPLES_PER_BIT, LINE_CODE>::set_idle_decimation(
+    uint8_t decimation) {
+  if (decimation == 0 || cdr.amp_det_period() < decimation) {
+    VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+  }
+  idle_decimation = decimation;
+  return Result::SUCCESS;
+}
+
+template <uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+Result ReceiverT<SAMPLES_PER_BIT, LINE_CODE>::update(uint16_t adc_val,
+                                                     RxState *rx_state) {
+  if (!squelch_open && !squelch_step(adc_val)) {
+    if (rx_state) *rx_state = decoder.get_state();
+    return Result::SUCCESS;
+  }
+
   CdrOutput cdrOut;
   VLCFG_TRY(cdr.update(adc_val, &cdrOut));
   if (cdrOut.rxed) last_bit = cdrOut.rx_bit;
@@ -56,13 +131,172 @@ Result Receiver::update(uint16_t adc_val, RxState *rx_state) {
   PcsOutput pcsOut;
   VLCFG_TRY(pcs.update(&cdrOut, &pcsOut));
   if (pcsOut.rxed) last_byte = pcsOut.rx_byte;
+  pam4_control(cdr, pcsOut);
+  VLCFG_TRY(dual_rate_control(cdr, pcs, pcsOut));
 
   VLCFG_TRY(decoder.update(&pcsOut, rx_state));
+  VLCFG_TRY(decoder.update_timer(cdr.sample_period_us(), rx_state));
 
+  squelch_hang(1);
   return Result::SUCCESS;
 }
 
-#endif
+// Places the sample on the sampling grid by its timestamp, so that the samples
+// do not have to be taken at exact intervals. Skipped slots are filled by
+// linear interpolation and samples in a duplicated slot are dropped.
+template <uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+Result ReceiverT<SAMPLES_PER_BIT, LINE_CODE>::update(uint16_t adc_val,
+                                                     uint32_t timestamp_us,
+                                                     RxState *rx_state) {
+  // the samples are not placed on the grid while the squelch is closed
+  if (!squelch_open) return update(adc_val, rx_state);
+
+  const int32_t last_val = cdr.get_last_sample();
+  const uint32_t slots = cdr.advance_slots(timestamp_us);
+  if (slots == 0) {
+    if (rx_state) *rx_state = decoder.get_state();
+    return Result::SUCCESS;
+  }
+  for (uint32_t i = 1; i < slots; i++) {
+    int32_t val = last_val + ((int32_t)adc_val - last_val) * (int32_t)i /
+                                 (int32_t)slots;
+    VLCFG_TRY(update((uint16_t)val, rx_state));
+  }
+  return update(adc_val, rx_state);
+}
+
+// Processes a block of samples. Returns early when the signal is acquired or
+// lost, or when the decoder state changes (SOF, completion or error), so that
+// the caller can react before feeding the rest of the block.
+template <uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+Result ReceiverT<SAMPLES_PER_BIT, LINE_CODE>::update_block(
+    const uint16_t *samples, size_t n, RxState *rx_state, size_t *consumed) {
+  const RxState last_state = decoder.get_state();
+  if (rx_state) *rx_state = last_state;
+
+  size_t pos = 0;
+  while (pos < n) {
+    if (!squelch_open) {
+      // returns without consuming the sample that opened the squelch, so that
+      // the caller can return to the full sampling rate
+      while (pos < n && !squelch_step(samples[pos])) pos++;
+      break;
+    }
+
+    const bool last_sig_det = cdr.signal_detected();
+
+    // the chunk ends at the sample where the frame times out, as in update()
+    const uint32_t period_us = cdr.sample_period_us();
+    size_t limit = n - pos;
+    const uint32_t timer_us = decoder.get_timer_remaining_us();
+    if (timer_us > 0) {
+      const size_t timer_samples = (timer_us + period_us - 1) / period_us;
+      if (timer_samples < limit) limit = timer_samples;
+    }
+
+    CdrOutput cdrOut;
+    size_t cdr_consumed = 0;
+    Result ret = cdr.update_block(samples + pos, limit, &cdrOut, &cdr_consumed);
+    pos += cdr_consumed;
+    if (ret != Result::SUCCESS) {
+      if (consumed) *consumed = pos;
+      VLCFG_THROW(ret);
+    }
+    squelch_hang(cdr_consumed);
+
+    // every sample is timed, the last one after the decoder if it is passed
+    // on, as in update()
+    const bool to_decoder =
+        squelch_open &&
+        (cdrOut.rxed || cdrOut.signal_detected != last_sig_det);
+    const size_t timed = to_decoder ? cdr_consumed - 1 : cdr_consumed;
+    ret = decoder.update_timer(period_us * timed, rx_state);
+    if (ret != Result::SUCCESS) {
+      if (consumed) *consumed = pos;
+      VLCFG_THROW(ret);
+    }
+    if (!squelch_open) break;
+    if (!cdrOut.rxed && cdrOut.signal_detected == last_sig_det) break;
+    if (cdrOut.rxed) last_bit = cdrOut.rx_bit;
+
+    PcsOutput pcsOut;
+    ret = pcs.update(&cdrOut, &pcsOut);
+    if (ret == Result::SUCCESS) {
+      if (pcsOut.rxed) last_byte = pcsOut.rx_byte;
+      pam4_control(cdr, pcsOut);
+      ret = dual_rate_control(cdr, pcs, pcsOut);
+    }
+    if (ret == Result::SUCCESS) {
+      ret = decoder.update(&pcsOut, rx_state);
+    }
+    if (ret == Result::SUCCESS) {
+      ret = decoder.update_timer(cdr.sample_period_us(), rx_state);
+    }
+    if (ret != Result::SUCCESS) {
+      if (consumed) *consumed = pos;
+      VLCFG_THROW(ret);
+    }
+
+    if (cdrOut.signal_detected != last_sig_det) break;
+    if (decoder.get_state() != last_state) break;
+  }
+
+  if (consumed) *consumed = pos;
+  return Result::SUCCESS;
+}
+
+// Energy detection while the squelch is closed, returns true when the squelch
+// opens. Each sample stands for `idle_decimation` sampling slots.
+template <uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+bool ReceiverT<SAMPLES_PER_BIT, LINE_CODE>::squelch_step(uint16_t adc_val) {
+  if (squelch_slots == 0) {
+    squelch_max = adc_val;
+    squelch_min = adc_val;
+  } else if (adc_val > squelch_max) {
+    squelch_max = adc_val;
+  } else if (adc_val < squelch_min) {
+    squelch_min = adc_val;
+  }
+
+  if (squelch_max - squelch_min >= cdr.min_amp_gate()) {
+    VLCFG_PRINTF("Squelch opened.\n");
+    squelch_open = true;
+    squelch_slots = 0;
+    cdr.init();
+    return true;
+  }
+
+  squelch_slots += idle_decimation;
+  if (squelch_slots >= cdr.amp_det_period()) squelch_slots = 0;
+  return false;
+}
+
+// Closes the squelch when neither the amplitude nor a frame is present for
+// SQUELCH_HANG_WINDOWS amplitude detection windows.
+template <uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+void ReceiverT<SAMPLES_PER_BIT, LINE_CODE>::squelch_hang(uint32_t slots) {
+  if (!squelch) return;
+  if (cdr.amplitude_detected() || decoder.get_state() == RxState::RECEIVING) {
+    squelch_slots = 0;
+    return;
+  }
+  const uint32_t hang = (uint32_t)cdr.amp_det_period() * SQUELCH_HANG_WINDOWS;
+  slots += squelch_slots;
+  if (slots < hang) {
+    squelch_slots = slots;
+  } else {
+    VLCFG_PRINTF("Squelch closed.\n");
+    close_squelch();
+  }
+}
+
+template <uint8_t SAMPLES_PER_BIT, class LINE_CODE>
+void ReceiverT<SAMPLES_PER_BIT, LINE_CODE>::close_squelch() {
+  squelch_open = !squelch;
+  squelch_slots = 0;
+  squelch_max = 0;
+  squelch_min = 0;
+}
 
 }  // namespace vlcfg
 
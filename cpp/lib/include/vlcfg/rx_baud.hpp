@@ -0,0 +1,122 @@
+#ifndef VLCFG_RX_BAUD_HPP
+#define VLCFG_RX_BAUD_HPP
+
+#include "vlcfg/common.hpp"
+
+namespace vlcfg {
+
+static constexpr uint8_t BAUD_DET_INTERVALS = 16;
+
+// Baud rate detector for the CTRL/SYNC preamble.
+// `CTRL SYNC` (01010 10001) consists of runs of 1 and 3 bits only, so the
+// median edge interval is one bit period and every interval must be 1 or 3
+// times of it.
+class RxBaudDetector {
+ private:
+  uint16_t min_period_q8;
+  uint16_t max_period_q8;
+  bool has_last_edge;
+  uint32_t last_edge_time;
+  uint16_t intervals[BAUD_DET_INTERVALS];
+  uint8_t wr_index;
+  uint8_t num_intervals;
+  uint16_t period_q8;
+
+ public:
+  inline RxBaudDetector() { set_range(MIN_SAMPLES_PER_BIT << 8, 0xffff); }
+
+  void set_range(uint16_t min_period_q8, uint16_t max_period_q8);
+  void init();
+  bool on_edge(uint32_t time);
+  inline bool detected() const { return period_q8 != 0; }
+  // samples per bit in 8 bit fixed point
+  inline uint16_t get_period_q8() const { return period_q8; }
+
+ private:
+  uint32_t estimate(uint16_t period_q8) const;
+};
+
+#ifdef VLCFG_IMPLEMENTATION
+
+void RxBaudDetector::set_range(uint16_t min_period_q8, uint16_t max_period_q8) {
+  this->min_period_q8 = min_period_q8;
+  this->max_period_q8 = max_period_q8;
+  init();
+}
+
+void RxBaudDetector::init() {
+  has_last_edge = false;
+  last_edge_time = 0;
+  wr_index = 0;
+  num_intervals = 0;
+  period_q8 = 0;
+}
+
+// Returns true when the bit period is determined.
+bool RxBaudDetector::on_edge(uint32_t time) {
+  uint32_t interval = time - last_edge_time;
+  bool first = !has_last_edge;
+  has_last_edge = true;
+  last_edge_time = time;
+  if (first) return false;
+
+  if (interval > 0xffff) interval = 0xffff;
+  intervals[wr_index] = interval;
+  wr_index = (wr_index + 1) % BAUD_DET_INTERVALS;
+  if (num_intervals < BAUD_DET_INTERVALS) {
+    num_intervals++;
+    return false;
+  }
+
+  // median of the intervals as the initial guess
+  uint16_t sorted[BAUD_DET_INTERVALS];
+  for (uint8_t i = 0; i < BAUD_DET_INTERVALS; i++) {
+    uint16_t x = intervals[i];
+    uint8_t j = i;
+    for (; j > 0 && sorted[j - 1] > x; j--) {
+      sorted[j] = sorted[j - 1];
+    }
+    sorted[j] = x;
+  }
+  uint32_t guess = (uint32_t)sorted[BAUD_DET_INTERVALS / 2] << 8;
+
+  // refine twice with the least squares fit over the whole window
+  for (uint8_t i = 0; i < 2 && guess != 0; i++) {
+    guess = estimate(guess);
+  }
+
+  if (guess < min_period_q8 || max_period_q8 < guess) return false;
+
+  period_q8 = guess;
+  VLCFG_PRINTF("Baud detected: %d.%02d samples/bit\n", (int)(period_q8 >> 8),
+               (int)((period_q8 & 0xff) * 100 / 256));
+  return true;
+}
+
+// Returns the bit period fitted to the intervals, or 0 if the intervals do not
+// match the preamble.
+uint32_t RxBaudDetector::estimate(uint16_t period_q8) const {
+  if (period_q8 == 0) return 0;
+  uint32_t sum_time = 0;
+  uint16_t sum_bits = 0;
+  uint8_t num_long = 0;
+  for (uint8_t i = 0; i < BAUD_DET_INTERVALS; i++) {
+    uint32_t t = (uint32_t)intervals[i] << 8;
+    uint32_t bits = (t + period_q8 / 2) / period_q8;
+    if (bits == 3) {
+      num_long++;
+    } else if (bits != 1) {
+      return 0;
+    }
+    sum_time += t;
+    sum_bits += bits;
+  }
+  if (num_long == 0) return 0;
+  return sum_time / sum_bits;
+}
+
+#endif
+
+}  // namespace vlcfg
+
+#endif
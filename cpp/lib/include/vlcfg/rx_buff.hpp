@@ -2,6 +2,7 @@
 #define VLCFG_RX_BUFF_HPP
 
 #include "vlcfg/common.hpp"
+#include "vlcfg/crc32.hpp"
 
 namespace vlcfg {
 
@@ -91,6 +92,7 @@ class RxBuff {
   }
 
   Result read_item_header(CborMajorType *value_type, uint64_t *param);
+  bool crc_matches() const;
   Result check_and_remove_crc();
 };
 
@@ -136,19 +138,25 @@ Result RxBuff::read_item_header(CborMajorType *value_type, uint64_t *param) {
   return Result::SUCCESS;
 }
 
+// Checks the CRC at the end of the buffer without removing it.
+bool RxBuff::crc_matches() const {
+  if (write_pos < 4) return false;
+  uint16_t size = write_pos - 4;
+  uint32_t calcedCrc = crc32(buff, size);
+  uint32_t recvCrc = static_cast<uint32_t>(buff[size]) << 24 |
+                     static_cast<uint32_t>(buff[size + 1]) << 16 |
+                     static_cast<uint32_t>(buff[size + 2]) << 8 |
+                     static_cast<uint32_t>(buff[size + 3]);
+  return calcedCrc == recvCrc;
+}
+
 Result RxBuff::check_and_remove_crc() {
   if (write_pos < 4) {
     VLCFG_THROW(Result::ERR_UNEXPECTED_EOF);
   }
+  if (!crc_matches()) VLCFG_THROW(Result::ERR_BAD_CRC);
   write_pos -= 4;
-
-  uint32_t calcedCrc = crc32(buff, write_pos);
-  uint32_t recvCrc = static_cast<uint32_t>(buff[write_pos]) << 24 |
-                     static_cast<uint32_t>(buff[write_pos + 1]) << 16 |
-                     static_cast<uint32_t>(buff[write_pos + 2]) << 8 |
-                     static_cast<uint32_t>(buff[write_pos + 3]);
-  if (calcedCrc != recvCrc) VLCFG_THROW(Result::ERR_BAD_CRC);
-  VLCFG_PRINTF("CRC OK: 0x%08X\n", calcedCrc);
+  VLCFG_PRINTF("CRC OK\n");
   return Result::SUCCESS;
 }
 
@@ -0,0 +1,404 @@
+#ifndef VLCFG_RX_CBOR_HPP
+#define VLCFG_RX_CBOR_HPP
+
+#include "vlcfg/common.hpp"
+#include "vlcfg/crc32.hpp"
+
+namespace vlcfg {
+
+// Stores an integer item to `entry`.
+Result store_integer(ConfigEntry* entry, CborMajorType mtype, uint64_t param);
+// Stores a boolean item (simple value 20 or 21) to `entry`.
+Result store_boolean(ConfigEntry* entry, uint64_t param);
+// Checks that a string item of `len` bytes fits `entry`, and returns the size
+// it takes in the buffer, including the terminator of a text string.
+Result check_string(const ConfigEntry* entry, bool is_text, uint64_t len,
+                    uint16_t* buff_req);
+
+enum class CborParseState : uint8_t {
+  MAP_HEADER,
+  KEY_HEADER,
+  KEY,
+  VALUE_HEADER,
+  VALUE,
+  CRC,
+  DONE,
+};
+
+// entry index and 16 bit length in front of each value in the staging area
+static constexpr uint8_t STAGING_HEADER_SIZE = 3;
+
+// Push mode parser of the frame body, the CBOR map followed by the CRC32.
+//
+// Each byte is parsed as it arrives, so the frame needs no receive buffer.
+// The frame is aborted as soon as it cannot be valid (unknown key, type
+// mismatch, oversize value). The CRC is calculated on the fly, and finish()
+// marks the entries as received only if the CRC matches. The values are
+// written to a staging area and copied to the buffers of the entries by
+// finish(), or without a staging area, to the buffers of the entries straight
+// away, which leaves them undefined when the frame fails.
+class RxCborParser {
+ private:
+  ConfigEntry* entries = nullptr;
+  uint8_t* staging = nullptr;
+  uint16_t staging_capacity = 0;
+  uint16_t staging_pos;
+  CborParseState state = CborParseState::MAP_HEADER;
+  uint32_t crc;
+  uint32_t rx_crc;
+  uint8_t rx_crc_len;
+  uint16_t size;
+  // item header, `param_len` is the number of argument bytes left
+  CborMajorType mtype;
+  uint8_t param_len;
+  uint64_t param;
+  // entries left in the map
+  uint8_t num_entries;
+  char key[MAX_KEY_LEN + 1];
+  uint8_t key_len;
+  ConfigEntry* entry;
+  uint16_t value_len;
+  uint16_t value_pos;
+  uint8_t* value_buff;
+  // bit i is set when entry i has been written
+  uint32_t staged;
+
+ public:
+  // Sets the staging area, nullptr writes the values in place.
+  inline void set_staging(uint8_t* buff, uint16_t capacity) {
+    staging = buff;
+    staging_capacity = buff ? capacity : 0;
+  }
+  // staging area size that holds a value for each of `entries`
+  static uint32_t staging_size(const ConfigEntry* entries);
+  void init(ConfigEntry* entries);
+  Result push(uint8_t byte);
+  // Checks the CRC on EOF and marks the written entries as received.
+  Result finish();
+  inline CborParseState get_state() const { return state; }
+  // bytes received, including the CRC
+  inline uint16_t get_size() const { return size; }
+
+ private:
+  Result push_header(uint8_t byte, bool* done);
+  Result start_value();
+  Result stage(uint16_t len, uint8_t** dst);
+  void end_value();
+};
+
+#ifdef VLCFG_IMPLEMENTATION
+
+Result store_integer(ConfigEntry* entry, CborMajorType mtype, uint64_t param) {
+  uint8_t buff_req = 0;
+  bool rx_pos = mtype == CborMajorType::UNSIGNED_INT;
+  bool rx_neg = mtype == CborMajorType::NEGATIVE_INT;
+  bool rx_msb = (param & 0x8000000000000000) != 0;
+  if (entry->type == ValueType::UINT) {
+    if (rx_neg) VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+    if (param & 0xFFFFFFFF00000000) {
+      buff_req = 8;
+    } else if (param & 0x00000000FFFF0000) {
+      buff_req = 4;
+    } else if (param & 0x000000000000FF00) {
+      buff_req = 2;
+    } else {
+      buff_req = 1;
+    }
+  } else if (entry->type == ValueType::INT) {
+    if (rx_pos && rx_msb) VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+    if (rx_neg && rx_msb) VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+    if (param & 0xFFFFFFFF80000000) {
+      buff_req = 8;
+    } else if (param & 0x000000007FFF8000) {
+      buff_req = 4;
+    } else if (param & 0x0000000000007F80) {
+      buff_req = 2;
+    } else {
+      buff_req = 1;
+    }
+    if (rx_neg) {
+      param = static_cast<uint64_t>(-static_cast<int64_t>(param) - 1);
+    }
+  } else {
+    VLCFG_THROW(Result::ERR_VALUE_TYPE_MISMATCH);
+  }
+
+  if (buff_req > entry->capacity) {
+    VLCFG_THROW(Result::ERR_VALUE_TOO_LONG);
+  }
+  void* dst = entry->buffer;
+  switch (entry->capacity) {
+    case 1: *(uint8_t*)dst = static_cast<uint8_t>(param); break;
+    case 2: *(uint16_t*)dst = static_cast<uint16_t>(param); break;
+    case 4: *(uint32_t*)dst = static_cast<uint32_t>(param); break;
+    case 8: *(uint64_t*)dst = static_cast<uint64_t>(param); break;
+    default: VLCFG_THROW(Result::ERR_BUFF_SIZE_MISMATCH);
+  }
+  entry->received = entry->capacity;
+  return Result::SUCCESS;
+}
+
+Result store_boolean(ConfigEntry* entry, uint64_t param) {
+  if (param != 20 && param != 21) {
+    VLCFG_THROW(Result::ERR_UNSUPPORTED_TYPE);
+  }
+  if (entry->capacity != 1) {
+    VLCFG_THROW(Result::ERR_BUFF_SIZE_MISMATCH);
+  }
+  bool value = (param == 20) ? false : true;
+  *((uint8_t*)entry->buffer) = value ? 1 : 0;
+  entry->received = 1;
+  VLCFG_PRINTF("boolean value: %s\n", value ? "true" : "false");
+  return Result::SUCCESS;
+}
+
+Result check_string(const ConfigEntry* entry, bool is_text, uint64_t len,
+                    uint16_t* buff_req) {
+  ValueType exp_value_type =
+      is_text ? ValueType::TEXT_STR : ValueType::BYTE_STR;
+  if (entry->type != exp_value_type) {
+    VLCFG_THROW(Result::ERR_VALUE_TYPE_MISMATCH);
+  }
+  if (len + (is_text ? 1 : 0) > entry->capacity) {
+    VLCFG_THROW(Result::ERR_VALUE_TOO_LONG);
+  }
+  *buff_req = is_text ? len + 1 : len;
+  return Result::SUCCESS;
+}
+
+uint32_t RxCborParser::staging_size(const ConfigEntry* entries) {
+  uint32_t size = 0;
+  for (uint8_t i = 0; i < MAX_ENTRY_COUNT && entries[i].key; i++) {
+    size += STAGING_HEADER_SIZE + entries[i].capacity;
+  }
+  return size;
+}
+
+void RxCborParser::init(ConfigEntry* entries) {
+  this->entries = entries;
+  staging_pos = 0;
+  state = CborParseState::MAP_HEADER;
+  crc = 0xffffffff;
+  rx_crc = 0;
+  rx_crc_len = 0;
+  size = 0;
+  param_len = 0;
+  num_entries = 0;
+  staged = 0;
+}
+
+Result RxCborParser::push(uint8_t byte) {
+  if (state == CborParseState::DONE) {
+    VLCFG_THROW(Result::ERR_EXTRA_BYTES);
+  }
+  size++;
+  if (state == CborParseState::CRC) {
+    rx_crc = (rx_crc << 8) | byte;
+    if (++rx_crc_len >= 4) state = CborParseState::DONE;
+    return Result::SUCCESS;
+  }
+  crc = crc32_update(crc, byte);
+
+  bool done;
+  switch (state) {
+    case CborParseState::MAP_HEADER:
+      VLCFG_TRY(push_header(byte, &done));
+      if (!done) break;
+      if (mtype != CborMajorType::MAP) {
+        VLCFG_THROW(Result::ERR_UNSUPPORTED_TYPE);
+      }
+      if (param > MAX_ENTRY_COUNT) {
+        VLCFG_THROW(Result::ERR_TOO_MANY_ENTRIES);
+      }
+      num_entries = param;
+      VLCFG_PRINTF("CBOR object, num_entries=%d\n", num_entries);
+      state = num_entries > 0 ? CborParseState::KEY_HEADER
+                              : CborParseState::CRC;
+      break;
+
+    case CborParseState::KEY_HEADER:
+    case CborParseState::KEY:
+      if (state == CborParseState::KEY_HEADER) {
+        VLCFG_TRY(push_header(byte, &done));
+        if (!done) break;
+        if (mtype != CborMajorType::TEXT_STR) {
+          VLCFG_THROW(Result::ERR_KEY_TYPE_MISMATCH);
+        }
+        if (param > MAX_KEY_LEN) {
+          VLCFG_THROW(Result::ERR_KEY_TOO_LONG);
+        }
+        value_len = param;
+        key_len = 0;
+        state = CborParseState::KEY;
+      } else {
+        key[key_len++] = byte;
+      }
+      if (key_len >= value_len) {
+        key[key_len] = '\0';
+        VLCFG_PRINTF("key: '%s'\n", key);
+        int16_t entry_index = find_key(entries, key);
+        if (entry_index < 0) {
+          VLCFG_THROW(Result::ERR_KEY_NOT_FOUND);
+        }
+        entry = &entries[entry_index];
+        state = CborParseState::VALUE_HEADER;
+      }
+      break;
+
+    case CborParseState::VALUE_HEADER:
+      VLCFG_TRY(push_header(byte, &done));
+      if (done) VLCFG_TRY(start_value());
+      break;
+
+    case CborParseState::VALUE:
+      value_buff[value_pos++] = byte;
+      if (value_pos >= value_len) end_value();
+      break;
+
+    default: break;
+  }
+  return Result::SUCCESS;
+}
+
+Result RxCborParser::finish() {
+  if (state != CborParseState::DONE) {
+    VLCFG_THROW(Result::ERR_UNEXPECTED_EOF);
+  }
+  if (~crc != rx_crc) {
+    VLCFG_THROW(Result::ERR_BAD_CRC);
+  }
+  VLCFG_PRINTF("CRC OK\n");
+  for (uint16_t pos = 0; pos < staging_pos;) {
+    ConfigEntry& dst = entries[staging[pos]];
+    const uint16_t len = staging[pos + 1] | (staging[pos + 2] << 8);
+    pos += STAGING_HEADER_SIZE;
+    for (uint16_t i = 0; i < len; i++) {
+      ((uint8_t*)dst.buffer)[i] = staging[pos++];
+    }
+    dst.received = len;
+  }
+  for (uint8_t i = 0; i < MAX_ENTRY_COUNT; i++) {
+    if (staged & ((uint32_t)1 << i)) {
+      entries[i].flags |= ConfigEntryFlags::ENTRY_RECEIVED;
+    }
+  }
+  VLCFG_PRINTF("CBOR parsing completed successfully.\n");
+  return Result::SUCCESS;
+}
+
+// Same as RxBuff::read_item_header(), a byte at a time.
+Result RxCborParser::push_header(uint8_t byte, bool* done) {
+  if (param_len > 0) {
+    param = (param << 8) | byte;
+    *done = (--param_len == 0);
+    return Result::SUCCESS;
+  }
+
+  mtype = static_cast<CborMajorType>(byte >> 5);
+  const uint8_t short_count = (byte & 0x1f);
+  param = short_count;
+  *done = true;
+  if (mtype == CborMajorType::SIMPLE_OR_FLOAT) {
+    if (short_count != 20 && short_count != 21) {
+      VLCFG_THROW(Result::ERR_UNSUPPORTED_TYPE);
+    }
+  } else if (short_count > 27) {
+    VLCFG_THROW(Result::ERR_BAD_SHORT_COUNT);
+  } else if (short_count > 23) {
+    param = 0;
+    param_len = 1 << (short_count - 24);
+    *done = false;
+  }
+  return Result::SUCCESS;
+}
+
+Result RxCborParser::start_value() {
+  if (entry->buffer == nullptr) {
+    VLCFG_THROW(Result::ERR_NULL_POINTER);
+  }
+
+  // With a staging area, the integer and boolean values are stored to a copy
+  // of the entry that points to `scalar`, then staged.
+  ConfigEntry* dst = entry;
+  ConfigEntry copy;
+  uint64_t scalar;
+  if (staging) {
+    copy = *entry;
+    copy.buffer = &scalar;
+    dst = &copy;
+  }
+
+  switch (mtype) {
+    case CborMajorType::UNSIGNED_INT:
+    case CborMajorType::NEGATIVE_INT:
+      VLCFG_TRY(store_integer(dst, mtype, param));
+      break;
+
+    case CborMajorType::BYTE_STR:
+    case CborMajorType::TEXT_STR: {
+      const bool is_text = (mtype == CborMajorType::TEXT_STR);
+      uint16_t buff_req;
+      VLCFG_TRY(check_string(entry, is_text, param, &buff_req));
+      value_len = param;
+      value_pos = 0;
+      if (staging) {
+        VLCFG_TRY(stage(buff_req, &value_buff));
+      } else {
+        value_buff = (uint8_t*)entry->buffer;
+        entry->received = buff_req;
+      }
+      if (is_text) value_buff[value_len] = '\0';
+      if (value_len > 0) {
+        state = CborParseState::VALUE;
+        return Result::SUCCESS;
+      }
+      end_value();
+      return Result::SUCCESS;
+    }
+
+    case CborMajorType::SIMPLE_OR_FLOAT:
+      VLCFG_TRY(store_boolean(dst, param));
+      break;
+
+    default: VLCFG_THROW(Result::ERR_UNSUPPORTED_TYPE);
+  }
+
+  if (staging) {
+    uint8_t* rec;
+    VLCFG_TRY(stage(copy.received, &rec));
+    for (uint8_t i = 0; i < copy.received; i++) {
+      rec[i] = ((const uint8_t*)&scalar)[i];
+    }
+  }
+  end_value();
+  return Result::SUCCESS;
+}
+
+// Appends a value of `len` bytes for the current entry to the staging area.
+Result RxCborParser::stage(uint16_t len, uint8_t** dst) {
+  if ((uint32_t)staging_pos + STAGING_HEADER_SIZE + len > staging_capacity) {
+    VLCFG_THROW(Result::ERR_OVERFLOW);
+  }
+  uint8_t* rec = staging + staging_pos;
+  rec[0] = entry - entries;
+  rec[1] = len & 0xff;
+  rec[2] = len >> 8;
+  *dst = rec + STAGING_HEADER_SIZE;
+  staging_pos += STAGING_HEADER_SIZE + len;
+  return Result::SUCCESS;
+}
+
+void RxCborParser::end_value() {
+  staged |= (uint32_t)1 << (entry - entries);
+  if (--num_entries > 0) {
+    state = CborParseState::KEY_HEADER;
+  } else {
+    state = CborParseState::CRC;
+  }
+}
+
+#endif
+
+}  // namespace vlcfg
+
+#endif
@@ -2,90 +2,838 @@
 #define VLCFG_RX_CDR_HPP
 
 #include "vlcfg/common.hpp"
+#include "vlcfg/rx_baud.hpp"
+#include "vlcfg/u16log2.hpp"
 
 namespace vlcfg {
 
-static const uint16_t PHASE_PERIOD = VLBS_RX_SAMPLES_PER_BIT;
-static const uint16_t ADC_AVE_PERIOD = PHASE_PERIOD * SYMBOL_BITS * 2;
-static const uint8_t ADC_BITS = 12;
+// PLL phase is a 16 bit fraction of one bit period, edges are expected at 0.
+static constexpr uint32_t PLL_PHASE_ONE = 0x10000;
+static constexpr uint8_t PLL_FREQ_FRAC_BITS = 8;
+static constexpr uint8_t PLL_KP_SHIFT = 2;
+static constexpr uint8_t PLL_KI_SHIFT = 6;
+static constexpr uint8_t PLL_ACQ_KP_SHIFT = 1;
+static constexpr uint8_t PLL_ACQ_KI_SHIFT = 4;
+static constexpr uint8_t PLL_ACQ_EDGES = 16;
+// maximum frequency offset the PLL follows (1/8 = 12.5%)
+static constexpr uint8_t PLL_FREQ_RANGE_SHIFT = 3;
+// The bit period is exact with a transmitter locked to the display refresh,
+// so the loop is narrowed after acquisition.
+static constexpr uint8_t PLL_FRAME_KP_EXTRA = 1;
+static constexpr uint8_t PLL_FRAME_KI_EXTRA = 2;
+// The transmitter locks to the refreshes only if that moves the bit period by
+// at most 1/50 (2%), which the histogram engine can follow.
+static constexpr uint8_t FRAME_LOCK_TOL_DIV = 50;
 
-class RxCdr {
+// minimum peak-to-peak amplitude to detect a signal
+static constexpr uint16_t AMP_DET_GATE = 1 << (ADC_BITS - 7);
+// slicer hysteresis in the log domain
+static constexpr uint16_t SLICER_HYSTERESIS = 0x100;
+// adaptive slicer: minimum gate, and required peak-to-peak amplitude relative
+// to the mean absolute noise
+static constexpr uint16_t AMP_DET_MIN_GATE = 1 << (ADC_BITS - 9);
+static constexpr uint8_t AMP_DET_SNR = 4;
+// adaptive slicer: hysteresis is max(swing / 16, noise), up to swing / 8
+static constexpr uint8_t SLICER_HYS_SWING_SHIFT = 4;
+static constexpr uint8_t SLICER_HYS_NOISE_MUL = 1;
+static constexpr uint8_t SLICER_HYS_MAX_SHIFT = 3;
+static constexpr uint16_t SLICER_MIN_HYSTERESIS = 0x10;
+static constexpr uint8_t NOISE_AVE_SHIFT = 5;
+// envelope decay time constant in bits (rounded down to a power of 2)
+static constexpr uint8_t ENV_DECAY_BITS = 16;
+static constexpr uint8_t ENV_FRAC_BITS = 8;
+// edges required for signal detection in the fast lock mode
+static constexpr uint8_t FAST_LOCK_EDGES = 4;
+// PAM-4 training: symbol periods alternating between level 1 and 2
+static constexpr uint8_t PAM4_TRAIN_SYMBOLS = 8;
+// PAM-4 is used only if every level is at least 1/PAM4_MIN_EYE_DIV of the
+// swing apart from the next one (1/3 if evenly spaced)
+static constexpr uint8_t PAM4_MIN_EYE_DIV = 6;
+
+enum class AmpDetector : uint8_t {
+  // min/max over a window of 10 bits, threshold updated once per window
+  WINDOW,
+  // decaying peak detector, threshold updated every sample
+  ENVELOPE,
+};
+
+// Amplitude measurement passed to the AGC handler once per 10 bits.
+struct AmpStatus {
+  uint16_t high;
+  uint16_t low;
+  // mean absolute sample-to-sample difference within a bit, 0 if the adaptive
+  // slicer is disabled
+  uint16_t noise;
+  bool detected;
+};
+
+// Called from RxCdr::update() to drive an external gain or integration time.
+// The receiver follows the resulting level change by itself.
+using AgcHandler = void (*)(void *context, const AmpStatus &status);
+
+enum class BitDetector : uint8_t {
+  // takes the sample nearest to the center of the bit
+  SAMPLE,
+  // integrates the samples over the central half of the bit and slices the
+  // sum (integrate-and-dump). Done in the linear domain, as the log domain
+  // weights the low level more and biases windows overlapping an edge.
+  INTEGRATE,
+};
+
+enum class PamState : uint8_t {
+  // binary slicer
+  OFF,
+  // measuring the inner levels after the PAM4 marker
+  TRAINING,
+  // multi-threshold slicer, two bits per symbol period
+  ACTIVE,
+};
+
+enum class CdrEngine : uint8_t {
+  // picks the most frequent edge phase, needs ~10 samples per bit
+  HISTOGRAM,
+  // digital PLL with frequency tracking, works down to 3 samples per bit
+  PLL,
+};
+
+// Clock data recovery.
+// SAMPLES_PER_BIT fixes the oversampling ratio at compile time so that the
+// per-sample path is fully specialized. 0 selects a runtime-configured rate
+// (see set_rate()).
+template <uint8_t SAMPLES_PER_BIT = 0>
+class RxCdrT {
  private:
-  uint8_t amp_det_count;
+  static_assert(SAMPLES_PER_BIT == 0 ||
+                    (MIN_SAMPLES_PER_BIT <= SAMPLES_PER_BIT &&
+                     SAMPLES_PER_BIT <= MAX_SAMPLES_PER_BIT),
+                "Unsupported samples per bit.");
+  static constexpr uint8_t EDGE_LEVEL_SIZE =
+      SAMPLES_PER_BIT ? SAMPLES_PER_BIT : MAX_SAMPLES_PER_BIT;
+  // samples integrated by BitDetector::INTEGRATE with the histogram engine
+  static constexpr uint8_t BIT_WINDOW_SIZE = EDGE_LEVEL_SIZE / 2;
+
+  CdrEngine engine = CdrEngine::HISTOGRAM;
+  AmpDetector amp_detector = AmpDetector::WINDOW;
+  BitDetector bit_detector = BitDetector::SAMPLE;
+  bool fast_lock = false;
+  bool adaptive_slicer = false;
+  bool pam4 = false;
+  AgcHandler agc_handler = nullptr;
+  void *agc_context = nullptr;
+  RateConfig rate = default_rate_config(SAMPLES_PER_BIT);
+  // runtime bit period in samples (8 bit fixed point), may be fractional
+  // when detected by auto baud
+  uint16_t bit_period_q8 = rate.samples_per_bit << 8;
+  uint8_t spb = rate.samples_per_bit;
+  uint32_t pll_nominal = (PLL_PHASE_ONE << PLL_FREQ_FRAC_BITS) / spb;
+  bool auto_baud = false;
+  RxBaudDetector baud_det;
+  // display refresh period of the transmitter, 0 if unknown
+  uint32_t frame_period_us = 0;
+  uint32_t sample_us = rate.sample_period_us();
+  uint32_t sample_count;
+  uint16_t last_sample;
+  bool ts_valid;
+  uint32_t last_ts;
+  uint32_t ts_remainder;
+  uint16_t untimed_slots;
+  uint16_t amp_det_count;
   bool amp_det;
   uint16_t sig_det_count;
   bool sig_det;
   uint16_t peak_max;
   uint16_t peak_min;
   uint16_t threshold;
+  uint16_t mid_level;
+  uint16_t half_swing;
+  // distance of the last bit decision from mid_level
+  int32_t bit_dist;
+  uint16_t hysteresis;
+  uint32_t noise_q8;
+  uint16_t last_adc_val;
+  bool last_edge;
+  bool env_valid;
+  uint8_t env_shift;
+  uint32_t env_max;
+  uint32_t env_min;
   uint8_t last_digital_level;
   uint8_t phase;
   uint8_t sample_phase;
-  uint8_t edge_level[PHASE_PERIOD];
+  uint8_t edge_level[EDGE_LEVEL_SIZE];
+  uint16_t last_log_val;
+  uint16_t pll_phase;
+  uint32_t pll_freq;
+  uint8_t pll_edge_count;
+  bool pll_bit_done;
+  bool pll_last_level;
+  uint16_t pll_last_adc;
+  int32_t bit_acc;
+  uint8_t bit_acc_count;
+  bool bit_acc_done;
+  uint16_t bit_window[BIT_WINDOW_SIZE];
+  uint8_t bit_window_index;
+  uint32_t bit_window_sum;
+  PamState pam_state;
+  uint8_t pam_count;
+  int32_t pam_acc[2];
+  uint16_t pam_low;
+  uint16_t pam_mid;
+  uint16_t pam_high;
+  uint16_t pam_eye;
+  bool pam_upper;
+  uint8_t pam_upper_conf;
+  bool pam_pending;
+  bool pam_pending_bit;
+  uint8_t pam_pending_conf;
+  // payload rate multiplier of a dual-rate frame, 1 at the base rate
+  uint8_t rate_mul = 1;
+  uint16_t base_period_q8;
+  uint32_t rate_bits_left;
 
  public:
-  inline RxCdr() { init(); }
+  inline RxCdrT() { init(); }
   void init();
-  Result update(uint16_t adc_val, CdrOutput* out);
+  void set_engine(CdrEngine engine);
+  inline CdrEngine get_engine() const { return engine; }
+  void set_amp_detector(AmpDetector det);
+  inline AmpDetector get_amp_detector() const { return amp_detector; }
+  // Detects the signal after a few edges instead of 4 bit periods, use with
+  // AmpDetector::ENVELOPE to acquire the signal within one symbol pair.
+  void set_fast_lock(bool enable);
+  inline bool get_fast_lock() const { return fast_lock; }
+  void set_bit_detector(BitDetector det);
+  inline BitDetector get_bit_detector() const { return bit_detector; }
+  // Scales the slicer hysteresis and the amplitude detection gate with the
+  // measured swing and noise instead of the fixed values.
+  void set_adaptive_slicer(bool enable);
+  inline bool get_adaptive_slicer() const { return adaptive_slicer; }
+  inline void set_agc_handler(AgcHandler handler, void *context) {
+    agc_handler = handler;
+    agc_context = context;
+  }
+  // Accepts the PAM-4 frames announced by the PAM4 marker. The receiver calls
+  // start_pam4() and stop_pam4() on the PCS events.
+  void set_pam4(bool enable);
+  inline bool get_pam4() const { return pam4; }
+  void start_pam4();
+  void stop_pam4();
+  inline PamState get_pam_state() const { return pam_state; }
+  // Switches the bit period to 1/`mul` of the current one for the payload of
+  // a dual-rate frame, and back after `bits` bits or on the loss of the
+  // signal. Needs a runtime-configured rate, and an integer number of samples
+  // per bit with CdrEngine::HISTOGRAM.
+  Result start_dual_rate(uint8_t mul, uint32_t bits);
+  void stop_dual_rate();
+  inline uint8_t get_rate_mul() const { return rate_mul; }
+  inline uint16_t get_threshold() const { return threshold; }
+  inline uint16_t get_hysteresis() const { return hysteresis; }
+  inline uint16_t get_noise() const { return noise_q8 >> 8; }
+  Result set_rate(const RateConfig &rate);
+  inline const RateConfig &get_rate() const { return rate; }
+  // sampling interval, differs from the one of get_rate() with
+  // set_frame_period_us()
+  inline uint32_t sample_period_us() const { return sample_us; }
+  inline uint8_t samples_per_bit() const {
+    return SAMPLES_PER_BIT ? SAMPLES_PER_BIT : spb;
+  }
+  inline uint16_t get_bit_period_q8() const {
+    return SAMPLES_PER_BIT ? (SAMPLES_PER_BIT << 8) : bit_period_q8;
+  }
+  // Expects a transmitter that locks the bit period to an integer number of
+  // display refreshes of `frame_period_us`. 0 disables the profile, as does a
+  // refresh rate that the transmitter does not lock to.
+  Result set_frame_period_us(uint32_t frame_period_us);
+  inline uint32_t get_frame_period_us() const { return frame_period_us; }
+  Result enable_auto_baud(uint16_t min_baudrate, uint16_t max_baudrate);
+  void disable_auto_baud();
+  inline bool baud_detected() const {
+    return !auto_baud || baud_det.detected();
+  }
+  Result update(uint16_t adc_val, CdrOutput *out);
+  Result update_block(const uint16_t *samples, size_t n, CdrOutput *out,
+                      size_t *consumed);
   inline bool signal_detected() const { return sig_det; }
-};
-
-#ifdef VLCFG_IMPLEMENTATION
-static uint16_t u16log2(uint16_t x);
+  inline bool amplitude_detected() const { return amp_det; }
+  // samples per amplitude detection window (10 bits)
+  inline uint16_t amp_det_period() const {
+    return samples_per_bit() * SYMBOL_BITS * 2;
+  }
+  // smallest swing that can be detected with the current slicer settings
+  inline uint16_t min_amp_gate() const {
+    return adaptive_slicer ? AMP_DET_MIN_GATE : AMP_DET_GATE;
+  }
+  uint32_t advance_slots(uint32_t timestamp_us);
+  inline uint16_t get_last_sample() const { return last_sample; }
 
-static const uint16_t U16LOG2_TABLE[17] = {
-    0,   22,  44,  63,  82,  100, 118, 134, 150,
-    165, 179, 193, 207, 220, 232, 244, 256,
+ private:
+  inline bool step(uint16_t adc_val, uint16_t log_val, bool *rx_bit,
+                   uint8_t *rx_conf);
+  inline bool histogram_step(uint16_t adc_val, bool edge, bool digital_level,
+                             bool *rx_bit);
+  inline bool pll_step(uint16_t adc_val, uint16_t log_val, bool edge,
+                       bool digital_level, bool *rx_bit);
+  inline bool integrate_step(uint16_t adc_val, bool center, bool *rx_bit);
+  inline uint8_t bit_confidence(bool rx_bit) const;
+  inline bool pam4_step(bool *rx_bit, uint8_t *rx_conf);
+  inline uint8_t pam4_confidence(int32_t dist) const;
+  void finish_pam4_training();
+  inline void envelope_step(uint16_t adc_val);
+  inline void update_slicer(uint16_t high, uint16_t low);
+  inline uint32_t pll_nominal_freq() const {
+    return SAMPLES_PER_BIT
+               ? (PLL_PHASE_ONE << PLL_FREQ_FRAC_BITS) / SAMPLES_PER_BIT
+               : pll_nominal;
+  }
+  void set_bit_period_q8(uint16_t period_q8);
+  void rescale_timing(uint8_t mul, bool faster);
+  void reset_timing();
 };
 
-void RxCdr::init() {
+using RxCdr = RxCdrT<>;
+
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::init() {
+  amp_det_count = 0;
   sig_det_count = 0;
   amp_det = false;
   sig_det = false;
   threshold = 2048;
+  mid_level = 0;
+  half_swing = 0;
+  bit_dist = 0;
+  hysteresis = SLICER_HYSTERESIS;
+  noise_q8 = 0;
+  last_adc_val = 0;
+  last_edge = true;
   last_digital_level = false;
-  phase = 0;
-  sample_phase = PHASE_PERIOD * 3 / 4;
   peak_min = 9999;
   peak_max = 0;
+  env_valid = false;
+  env_max = 0;
+  env_min = 0;
+  last_log_val = 0;
+  sample_count = 0;
+  last_sample = 0;
+  ts_valid = false;
+  last_ts = 0;
+  ts_remainder = 0;
+  untimed_slots = 0;
+  pam_state = PamState::OFF;
+  pam_pending = false;
+  if (rate_mul > 1) set_bit_period_q8(base_period_q8);
+  rate_mul = 1;
+  rate_bits_left = 0;
+  baud_det.init();
+  reset_timing();
   VLCFG_PRINTF("RX CDR initialized.\n");
 }
 
-// clock data recovery
-Result RxCdr::update(uint16_t adc_val, CdrOutput* out) {
-  out->rxed = false;
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::reset_timing() {
+  env_shift = 0;
+  while ((2u << env_shift) <= (uint32_t)samples_per_bit() * ENV_DECAY_BITS) {
+    env_shift++;
+  }
+  phase = 0;
+  sample_phase = samples_per_bit() * 3 / 4;
+  for (int i = 0; i < EDGE_LEVEL_SIZE; i++) {
+    edge_level[i] = 0;
+  }
+  pll_phase = 0;
+  pll_freq = pll_nominal_freq();
+  pll_edge_count = 0;
+  pll_bit_done = false;
+  pll_last_level = false;
+  pll_last_adc = 0;
+  bit_acc = 0;
+  bit_acc_count = 0;
+  bit_acc_done = true;
+  for (int i = 0; i < BIT_WINDOW_SIZE; i++) {
+    bit_window[i] = 0;
+  }
+  bit_window_index = 0;
+  bit_window_sum = 0;
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::set_engine(CdrEngine engine) {
+  this->engine = engine;
+  init();
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::set_amp_detector(AmpDetector det) {
+  this->amp_detector = det;
+  init();
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::set_fast_lock(bool enable) {
+  this->fast_lock = enable;
+  init();
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::set_bit_detector(BitDetector det) {
+  this->bit_detector = det;
+  init();
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::set_adaptive_slicer(bool enable) {
+  this->adaptive_slicer = enable;
+  init();
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::set_pam4(bool enable) {
+  this->pam4 = enable;
+  init();
+}
+
+// Called when the PCS receives the PAM4 marker. The following symbol periods
+// are the training levels.
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::start_pam4() {
+  if (!pam4 || pam_state != PamState::OFF) return;
+  pam_state = PamState::TRAINING;
+  pam_count = 0;
+  pam_acc[0] = 0;
+  pam_acc[1] = 0;
+  pam_pending = false;
+}
+
+// Called on the end of the frame or the loss of the symbol lock.
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::stop_pam4() {
+  if (pam_state == PamState::OFF) return;
+  VLCFG_PRINTF("PAM-4 stopped.\n");
+  pam_state = PamState::OFF;
+  pam_pending = false;
+}
+
+// Called when the PCS receives a dual-rate header. The payload follows at
+// `mul` times the current rate from the next bit boundary.
+template <uint8_t SAMPLES_PER_BIT>
+Result RxCdrT<SAMPLES_PER_BIT>::start_dual_rate(uint8_t mul, uint32_t bits) {
+  stop_dual_rate();
+  const uint16_t period_q8 = get_bit_period_q8();
+  if (SAMPLES_PER_BIT != 0 || mul < 2 ||
+      period_q8 < ((uint16_t)MIN_SAMPLES_PER_BIT << 8) * mul) {
+    VLCFG_THROW(Result::ERR_UNSUPPORTED_RATE);
+  }
+  if (engine == CdrEngine::HISTOGRAM && period_q8 % (mul << 8) != 0) {
+    VLCFG_THROW(Result::ERR_UNSUPPORTED_RATE);
+  }
+  base_period_q8 = period_q8;
+  rate_mul = mul;
+  rate_bits_left = bits;
+  set_bit_period_q8(period_q8 / mul);
+  rescale_timing(mul, true);
+  VLCFG_PRINTF("Dual-rate started: x%d\n", (int)mul);
+  return Result::SUCCESS;
+}
 
+// Returns to the base rate on the end of the payload.
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::stop_dual_rate() {
+  if (rate_mul <= 1) return;
+  const uint8_t mul = rate_mul;
+  rate_mul = 1;
+  set_bit_period_q8(base_period_q8);
+  rescale_timing(mul, false);
+  VLCFG_PRINTF("Dual-rate stopped.\n");
+}
+
+// Carries the bit timing over a change of the bit period by `mul`, so that
+// the bit boundaries stay where they are. The PLL keeps its frequency offset.
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::rescale_timing(uint8_t mul, bool faster) {
+  if (faster) {
+    pll_phase *= mul;
+    pll_freq *= mul;
+  } else {
+    pll_phase = ((int32_t)pll_phase - (int32_t)PLL_PHASE_ONE) / mul;
+    pll_freq /= mul;
+  }
+  pll_edge_count = 0;
+  pll_bit_done = true;
+  bit_acc_done = true;
+
+  // the edges of the histogram are folded onto the boundary of the new
+  // period, the distance to the next boundary is kept
+  const uint8_t old_period = faster ? samples_per_bit() * mul
+                                    : samples_per_bit() / mul;
+  const uint8_t period = samples_per_bit();
+  const uint8_t boundary =
+      (sample_phase + old_period - old_period / 2) % old_period;
+  const uint8_t ahead = (boundary + old_period - phase) % old_period;
+  const uint8_t new_boundary = boundary % period;
+  phase = (new_boundary + period - ahead % period) % period;
+  for (uint8_t i = 0; i < EDGE_LEVEL_SIZE; i++) {
+    edge_level[i] = 0;
+  }
+  edge_level[new_boundary] = period;
+  sample_phase = (new_boundary + period / 2) % period;
+  for (uint8_t i = 0; i < BIT_WINDOW_SIZE; i++) {
+    bit_window[i] = 0;
+  }
+  bit_window_index = 0;
+  bit_window_sum = 0;
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+Result RxCdrT<SAMPLES_PER_BIT>::set_rate(const RateConfig &rate) {
+  if (rate.baudrate == 0) {
+    VLCFG_THROW(Result::ERR_UNSUPPORTED_RATE);
+  }
+  if (SAMPLES_PER_BIT != 0 && rate.samples_per_bit != SAMPLES_PER_BIT) {
+    VLCFG_THROW(Result::ERR_UNSUPPORTED_RATE);
+  }
+  if (rate.samples_per_bit < MIN_SAMPLES_PER_BIT ||
+      MAX_SAMPLES_PER_BIT < rate.samples_per_bit) {
+    VLCFG_THROW(Result::ERR_UNSUPPORTED_RATE);
+  }
+  this->rate = rate;
+  frame_period_us = 0;
+  sample_us = rate.sample_period_us();
+  rate_mul = 1;
+  set_bit_period_q8(rate.samples_per_bit << 8);
+  init();
+  return Result::SUCCESS;
+}
+
+// The bit period becomes the nominal one rounded to whole display refreshes,
+// and the sampling interval (sample_period_us()) is scaled to keep the
+// samples per bit. Call after set_rate().
+template <uint8_t SAMPLES_PER_BIT>
+Result RxCdrT<SAMPLES_PER_BIT>::set_frame_period_us(uint32_t frame_period_us) {
+  uint32_t sample_us = rate.sample_period_us();
+  if (frame_period_us != 0) {
+    const uint32_t bit_us = rate.bit_period_us();
+    uint32_t frames = (bit_us + frame_period_us / 2) / frame_period_us;
+    if (frames == 0) frames = 1;
+    const uint32_t locked_us = frames * frame_period_us;
+    const uint32_t error_us =
+        locked_us > bit_us ? locked_us - bit_us : bit_us - locked_us;
+    if (error_us * FRAME_LOCK_TOL_DIV > bit_us) {
+      VLCFG_PRINTF("Bit period not locked to the frame period.\n");
+      frame_period_us = 0;
+    } else {
+      sample_us = locked_us / rate.samples_per_bit;
+    }
+    if (sample_us == 0) {
+      VLCFG_THROW(Result::ERR_UNSUPPORTED_RATE);
+    }
+  }
+  this->frame_period_us = frame_period_us;
+  this->sample_us = sample_us;
+  init();
+  return Result::SUCCESS;
+}
+
+// Enables detection of the baud rate from the CTRL/SYNC preamble. The
+// sampling interval stays at the one of the configured rate.
+template <uint8_t SAMPLES_PER_BIT>
+Result RxCdrT<SAMPLES_PER_BIT>::enable_auto_baud(uint16_t min_baudrate,
+                                                 uint16_t max_baudrate) {
+  if (SAMPLES_PER_BIT != 0) {
+    VLCFG_THROW(Result::ERR_UNSUPPORTED_RATE);
+  }
+  if (min_baudrate == 0 || max_baudrate < min_baudrate) {
+    VLCFG_THROW(Result::ERR_UNSUPPORTED_RATE);
+  }
+  uint32_t samples_per_sec_q8 = (1000000ul << 8) / sample_us;
+  uint32_t min_period_q8 = samples_per_sec_q8 / max_baudrate;
+  uint32_t max_period_q8 = samples_per_sec_q8 / min_baudrate;
+  if (min_period_q8 < (MIN_SAMPLES_PER_BIT << 8)) {
+    min_period_q8 = MIN_SAMPLES_PER_BIT << 8;
+  }
+  if (max_period_q8 > (MAX_SAMPLES_PER_BIT << 8)) {
+    max_period_q8 = MAX_SAMPLES_PER_BIT << 8;
+  }
+  if (max_period_q8 < min_period_q8) {
+    VLCFG_THROW(Result::ERR_UNSUPPORTED_RATE);
+  }
+  baud_det.set_range(min_period_q8, max_period_q8);
+  auto_baud = true;
+  init();
+  return Result::SUCCESS;
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::disable_auto_baud() {
+  auto_baud = false;
+  rate_mul = 1;
+  set_bit_period_q8(rate.samples_per_bit << 8);
+  init();
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::set_bit_period_q8(uint16_t period_q8) {
+  if (SAMPLES_PER_BIT != 0) return;
+  bit_period_q8 = period_q8;
+  spb = (period_q8 + 0x80) >> 8;
+  if (spb < MIN_SAMPLES_PER_BIT) spb = MIN_SAMPLES_PER_BIT;
+  if (spb > MAX_SAMPLES_PER_BIT) spb = MAX_SAMPLES_PER_BIT;
+  pll_nominal = ((uint64_t)PLL_PHASE_ONE << (PLL_FREQ_FRAC_BITS + 8)) /
+                period_q8;
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+Result RxCdrT<SAMPLES_PER_BIT>::update(uint16_t adc_val, CdrOutput *out) {
   if (out == nullptr) {
     VLCFG_THROW(Result::ERR_NULL_POINTER);
   }
 
+  out->rxed = step(adc_val, u16log2(adc_val), &out->rx_bit, &out->rx_conf);
+  out->signal_detected = sig_det;
+  return Result::SUCCESS;
+}
+
+// Processes samples until a bit is recovered or the signal detection state
+// changes, so that the caller only has to run the PCS when something happened.
+template <uint8_t SAMPLES_PER_BIT>
+Result RxCdrT<SAMPLES_PER_BIT>::update_block(const uint16_t *samples,
+                                             size_t n, CdrOutput *out,
+                                             size_t *consumed) {
+  if (out == nullptr || consumed == nullptr) {
+    VLCFG_THROW(Result::ERR_NULL_POINTER);
+  }
+  if (samples == nullptr && n > 0) {
+    VLCFG_THROW(Result::ERR_NULL_POINTER);
+  }
+
+  // The samples are log transformed one at a time. The call returns after
+  // about one bit, so a block transform would redo the rest of each chunk on
+  // the next call, and step() dominates the cost anyway.
+  const bool last_sig_det = sig_det;
+  bool rxed = false;
+  size_t i = 0;
+  while (i < n && !rxed && sig_det == last_sig_det) {
+    rxed = step(samples[i], u16log2(samples[i]), &out->rx_bit, &out->rx_conf);
+    i++;
+  }
+
+  out->rxed = rxed;
+  out->signal_detected = sig_det;
+  *consumed = i;
+  return Result::SUCCESS;
+}
+
+// Returns the number of sampling slots from the last timestamp to
+// `timestamp_us`, rounded to the nearest slot. 0 means the slot is
+// duplicated. The CDR is restarted after a gap longer than 10 bits.
+template <uint8_t SAMPLES_PER_BIT>
+uint32_t RxCdrT<SAMPLES_PER_BIT>::advance_slots(uint32_t timestamp_us) {
+  const uint32_t period = sample_us;
+  uint32_t slots = 1;
+  if (ts_valid) {
+    const uint32_t elapsed = timestamp_us - last_ts + ts_remainder;
+    if (elapsed / period <= amp_det_period()) {
+      slots = elapsed / period;
+      ts_remainder = elapsed - slots * period;
+      // the filled slots and the next sample give no edge timing
+      if (slots > 1) untimed_slots = slots;
+    } else {
+      VLCFG_PRINTF("Sampling gap too long, CDR restarted.\n");
+      init();
+    }
+  }
+  if (!ts_valid) {
+    ts_valid = true;
+    ts_remainder = period / 2;
+  }
+  last_ts = timestamp_us;
+  return slots;
+}
+
+// clock data recovery
+template <uint8_t SAMPLES_PER_BIT>
+inline bool RxCdrT<SAMPLES_PER_BIT>::step(uint16_t adc_val, uint16_t log_val,
+                                          bool *rx_bit, uint8_t *rx_conf) {
   // amplitude detection
-  if (amp_det_count < ADC_AVE_PERIOD) {
+  if (amp_detector == AmpDetector::ENVELOPE) {
+    envelope_step(adc_val);
+  } else if (amp_det_count < amp_det_period()) {
     amp_det_count++;
     if (adc_val > peak_max) peak_max = adc_val;
     if (adc_val < peak_min) peak_min = adc_val;
   } else {
     amp_det_count = 0;
-    amp_det = (peak_max - peak_min) >= (1 << (ADC_BITS - 7));
-    threshold = u16log2((peak_max + peak_min) / 2);
+    update_slicer(peak_max, peak_min);
+    if (agc_handler) {
+      agc_handler(agc_context,
+                  AmpStatus{peak_max, peak_min, get_noise(), amp_det});
+    }
     peak_max = adc_val;
     peak_min = adc_val;
   }
 
   bool los = !amp_det;
-
-  adc_val = u16log2(adc_val);
+  if (los) stop_dual_rate();
 
   // level/edge detection
-  int16_t hysteresis = (last_digital_level != 0) ? 0x100 : -0x100;
-  bool digital_level = adc_val + hysteresis >= threshold;
+  int32_t hys = (last_digital_level != 0) ? hysteresis : -hysteresis;
+  bool digital_level = (int32_t)log_val + hys >= threshold;
   bool edge = (digital_level != last_digital_level);
   last_digital_level = digital_level;
 
+  // edges in the slots filled after a sampling gap are not used for timing
+  bool timed_edge = edge;
+  if (untimed_slots > 0) {
+    untimed_slots--;
+    timed_edge = false;
+  }
+  // the training levels may be close to the binary threshold, the timing
+  // coasts until the PAM-4 threshold is set
+  if (pam_state == PamState::TRAINING) timed_edge = false;
+
+  // noise estimation, excluding transitions
+  if (adaptive_slicer) {
+    if (!edge && !last_edge) {
+      uint32_t diff = (adc_val > last_adc_val) ? (adc_val - last_adc_val)
+                                               : (last_adc_val - adc_val);
+      noise_q8 += (int32_t)((diff << 8) - noise_q8) >> NOISE_AVE_SHIFT;
+    }
+    last_adc_val = adc_val;
+    last_edge = edge;
+  }
+
+  // baud rate detection
+  if (auto_baud) {
+    sample_count++;
+    if (los) {
+      baud_det.init();
+    } else if (timed_edge && !baud_det.detected()) {
+      if (baud_det.on_edge(sample_count)) {
+        set_bit_period_q8(baud_det.get_period_q8());
+        reset_timing();
+        // the edge is between the last and current sample
+        pll_phase = -(uint16_t)((pll_nominal_freq() >> PLL_FREQ_FRAC_BITS) / 2);
+        sig_det_count = 0;
+      }
+    }
+    los |= !baud_det.detected();
+  }
+
+  // signal detection
+  if (los) {
+    sig_det_count = 0;
+    sig_det = false;
+  } else if (fast_lock) {
+    if (edge && sig_det_count < FAST_LOCK_EDGES) sig_det_count++;
+    sig_det = (sig_det_count >= FAST_LOCK_EDGES);
+  } else if (sig_det_count < samples_per_bit() * 4) {
+    sig_det_count++;
+    sig_det = false;
+  } else {
+    sig_det = true;
+  }
+
+  // timing recovery
+  bool bit_ready;
+  if (engine == CdrEngine::PLL) {
+    bit_ready =
+        pll_step(adc_val, log_val, timed_edge, digital_level, rx_bit);
+  } else {
+    bit_ready = histogram_step(adc_val, timed_edge, digital_level, rx_bit);
+  }
+  last_log_val = log_val;
+  last_sample = adc_val;
+  if (bit_ready && pam_state != PamState::OFF) {
+    bit_ready = pam4_step(rx_bit, rx_conf);
+  } else if (bit_ready) {
+    *rx_conf = bit_confidence(*rx_bit);
+  } else if (pam_pending) {
+    // the second bit of a PAM-4 symbol follows on the next sample
+    pam_pending = false;
+    bit_ready = true;
+    *rx_bit = pam_pending_bit;
+    *rx_conf = pam_pending_conf;
+  }
+
+  if (!sig_det) return false;
+  if (bit_ready && rate_mul > 1 && --rate_bits_left == 0) stop_dual_rate();
+  return bit_ready;
+}
+
+// Peak detectors that jump to new extremes and decay towards the signal, so
+// the threshold follows the signal continuously.
+template <uint8_t SAMPLES_PER_BIT>
+inline void RxCdrT<SAMPLES_PER_BIT>::envelope_step(uint16_t adc_val) {
+  const uint32_t x = (uint32_t)adc_val << ENV_FRAC_BITS;
+  if (!env_valid) {
+    env_valid = true;
+    env_max = x;
+    env_min = x;
+  }
+  if (x > env_max) {
+    env_max = x;
+  } else {
+    env_max -= (env_max - x) >> env_shift;
+  }
+  if (x < env_min) {
+    env_min = x;
+  } else {
+    env_min += (x - env_min) >> env_shift;
+  }
+  update_slicer(env_max >> ENV_FRAC_BITS, env_min >> ENV_FRAC_BITS);
+
+  if (agc_handler && ++amp_det_count >= amp_det_period()) {
+    amp_det_count = 0;
+    agc_handler(agc_context, AmpStatus{(uint16_t)(env_max >> ENV_FRAC_BITS),
+                                       (uint16_t)(env_min >> ENV_FRAC_BITS),
+                                       get_noise(), amp_det});
+  }
+}
+
+// Updates the amplitude detection and slicer parameters from the signal
+// levels.
+template <uint8_t SAMPLES_PER_BIT>
+inline void RxCdrT<SAMPLES_PER_BIT>::update_slicer(uint16_t high,
+                                                   uint16_t low) {
+  const uint16_t swing = (high > low) ? (high - low) : 0;
+  if (pam_state != PamState::OFF) {
+    // the levels are fixed by the training while in PAM-4
+    amp_det = swing >= min_amp_gate();
+    return;
+  }
+  const uint16_t mid = (high + low) / 2;
+  threshold = u16log2(mid);
+  mid_level = mid;
+  half_swing = swing / 2;
+  if (!adaptive_slicer) {
+    amp_det = swing >= AMP_DET_GATE;
+    return;
+  }
+
+  const uint32_t noise = noise_q8 >> 8;
+  uint32_t gate = noise * AMP_DET_SNR;
+  if (gate < AMP_DET_MIN_GATE) gate = AMP_DET_MIN_GATE;
+  amp_det = swing >= gate;
+
+  uint32_t hys = swing >> SLICER_HYS_SWING_SHIFT;
+  if (hys < noise * SLICER_HYS_NOISE_MUL) hys = noise * SLICER_HYS_NOISE_MUL;
+  const uint32_t hys_max = swing >> SLICER_HYS_MAX_SHIFT;
+  if (hys > hys_max) hys = hys_max;
+  if (mid + hys > 0xffff) hys = 0xffff - mid;
+  hysteresis = u16log2(mid + hys) - threshold;
+  if (hysteresis < SLICER_MIN_HYSTERESIS) hysteresis = SLICER_MIN_HYSTERESIS;
+}
+
+template <uint8_t SAMPLES_PER_BIT>
+inline bool RxCdrT<SAMPLES_PER_BIT>::histogram_step(uint16_t adc_val,
+                                                    bool edge,
+                                                    bool digital_level,
+                                                    bool *rx_bit) {
+  const uint8_t period = samples_per_bit();
+  bool bit_ready = false;
+
   // edge logging
   if (edge) {
-    if (edge_level[phase] < PHASE_PERIOD * 2) {
-      edge_level[phase] += PHASE_PERIOD;
+    if (edge_level[phase] < period * 2) {
+      edge_level[phase] += period;
     }
   } else {
     if (edge_level[phase] > 0) {
@@ -97,106 +845,256 @@ Result RxCdr::update(uint16_t adc_val, CdrOutput* out) {
   if (edge) {
     uint8_t edge_max_level = 0;
     int edge_max_phase = 0;
-    for (int i = 0; i < PHASE_PERIOD; i++) {
+    for (int i = 0; i < period; i++) {
       if (edge_level[i] > edge_max_level) {
         edge_max_level = edge_level[i];
         edge_max_phase = i;
       }
     }
-    auto last_phase = sample_phase;
-    sample_phase = edge_max_phase + PHASE_PERIOD / 2;
-    if (sample_phase >= PHASE_PERIOD) {
-      sample_phase -= PHASE_PERIOD;
+    sample_phase = edge_max_phase + period / 2;
+    if (sample_phase >= period) {
+      sample_phase -= period;
     }
-
-#if 0
-    // ディスプレイの点滅のジッタがかなり大きいので
-    // 位相変化のチェックはしない
-    int8_t phase_diff = sample_phase - last_phase;
-    if (phase_diff < -PHASE_PERIOD / 2) {
-      phase_diff += PHASE_PERIOD;
-    } else if (phase_diff > PHASE_PERIOD / 2) {
-      phase_diff -= PHASE_PERIOD;
-    }
-    constexpr int8_t TOL = PHASE_PERIOD / 4;
-    los |= (phase_diff < -TOL || TOL < phase_diff);
-#endif
   }
 
-  // signal detection
-  if (los) {
-    sig_det_count = 0;
-    sig_det = false;
-  } else if (sig_det_count < PHASE_PERIOD * 4) {
-    sig_det_count++;
-    sig_det = false;
-  } else {
-    sig_det = true;
-  }
-  out->signal_detected = sig_det;
-
   // data recovery
-  if (sig_det && phase == sample_phase) {
-    const uint8_t tol = (PHASE_PERIOD + 4) / 5;
-    const uint8_t mn = PHASE_PERIOD - tol;
-    const uint8_t mx = PHASE_PERIOD + tol;
-    out->rxed = true;
-    out->rx_bit = digital_level;
+  if (bit_detector == BitDetector::INTEGRATE) {
+    // Moving sum of the last half bit, sliced at sample_phase. The histogram
+    // tends to place sample_phase late, so the window ends there.
+    const uint8_t width = period / 2;
+    bit_window_sum += adc_val - bit_window[bit_window_index];
+    bit_window[bit_window_index] = adc_val;
+    if (++bit_window_index >= width) bit_window_index = 0;
+    if (phase == sample_phase) {
+      bit_ready = true;
+      bit_dist = (int32_t)(bit_window_sum / width) - mid_level;
+      *rx_bit = bit_window_sum >= (uint32_t)mid_level * width;
+    }
+  } else if (phase == sample_phase) {
+    bit_ready = true;
+    bit_dist = (int32_t)adc_val - mid_level;
+    *rx_bit = digital_level;
   }
 
   // step CDR phase
-  if (phase < PHASE_PERIOD - 1) {
+  if (phase < period - 1) {
     phase++;
   } else {
     phase = 0;
   }
 
-  return Result::SUCCESS;
+  return bit_ready;
 }
 
-static uint16_t u16log2(uint16_t x) {
-  if (x == 0) return 0;
+template <uint8_t SAMPLES_PER_BIT>
+inline bool RxCdrT<SAMPLES_PER_BIT>::pll_step(uint16_t adc_val,
+                                              uint16_t log_val, bool edge,
+                                              bool digital_level,
+                                              bool *rx_bit) {
+  const uint32_t nominal = pll_nominal_freq();
+  if (!amp_det) {
+    pll_freq = nominal;
+    pll_edge_count = 0;
+  }
+
+  const uint16_t inc = pll_freq >> PLL_FREQ_FRAC_BITS;
+  const uint16_t last_phase = pll_phase;
+  pll_phase += inc;
 
-  uint16_t ret = 0xc000;
-  if (x & 0xf000) {
-    if (x & 0xc000) {
-      x >>= 2;
-      ret += 0x2000;
-    }
-    if (x & 0x2000) {
-      x >>= 1;
-      ret += 0x1000;
-    }
-  } else {
-    if (!(x & 0xffc0)) {
-      x <<= 6;
-      ret -= 0x6000;
+  if (edge && amp_det) {
+    // locate the threshold crossing between the last and current sample
+    uint32_t frac = inc / 2;
+    int32_t span = (int32_t)log_val - last_log_val;
+    int32_t dist = (int32_t)threshold - last_log_val;
+    if (span < 0) {
+      span = -span;
+      dist = -dist;
     }
-    if (!(x & 0xfe00)) {
-      x <<= 3;
-      ret -= 0x3000;
+    if (span != 0) {
+      if (dist <= 0) {
+        frac = 0;
+      } else if (dist >= span) {
+        frac = inc;
+      } else {
+        frac = (uint32_t)dist * inc / (uint32_t)span;
+      }
     }
-    if (!(x & 0xf800)) {
-      x <<= 2;
-      ret -= 0x2000;
+
+    // bit boundaries are at phase 0
+    int16_t err = (int16_t)(uint16_t)(last_phase + frac);
+
+    bool acq = pll_edge_count < PLL_ACQ_EDGES;
+    if (acq) pll_edge_count++;
+    uint8_t kp = acq ? PLL_ACQ_KP_SHIFT : PLL_KP_SHIFT;
+    uint8_t ki = acq ? PLL_ACQ_KI_SHIFT : PLL_KI_SHIFT;
+    if (frame_period_us != 0 && !acq) {
+      kp += PLL_FRAME_KP_EXTRA;
+      ki += PLL_FRAME_KI_EXTRA;
     }
-    if (!(x & 0xf000)) {
-      x <<= 1;
-      ret -= 0x1000;
+    pll_phase -= err >> kp;
+    int32_t freq = (int32_t)pll_freq -
+                   ((int32_t)err * (1 << PLL_FREQ_FRAC_BITS) >> ki);
+    int32_t range = nominal >> PLL_FREQ_RANGE_SHIFT;
+    if (freq < (int32_t)nominal - range) freq = nominal - range;
+    if (freq > (int32_t)nominal + range) freq = nominal + range;
+    pll_freq = freq;
+  }
+
+  // sample the bit with the sample nearest to the center of the bit, or
+  // integrate the central half of the bit (always hit as inc <= 1/3)
+  bool bit_ready = false;
+  if (bit_detector == BitDetector::INTEGRATE) {
+    const uint16_t offset = pll_phase - PLL_PHASE_ONE / 4;
+    bit_ready = integrate_step(adc_val, offset < PLL_PHASE_ONE / 2, rx_bit);
+  } else if (pll_phase < PLL_PHASE_ONE / 2) {
+    pll_bit_done = false;
+  } else if (!pll_bit_done) {
+    pll_bit_done = true;
+    bit_ready = true;
+    uint16_t past_center = pll_phase - PLL_PHASE_ONE / 2;
+    bool current = (past_center * 2 < inc);
+    bit_dist = (int32_t)(current ? adc_val : pll_last_adc) - mid_level;
+    *rx_bit = current ? digital_level : pll_last_level;
+  }
+  pll_last_level = digital_level;
+  pll_last_adc = adc_val;
+
+  return bit_ready;
+}
+
+// Accumulates the samples while `center` is true and outputs the bit on the
+// first sample after that.
+template <uint8_t SAMPLES_PER_BIT>
+inline bool RxCdrT<SAMPLES_PER_BIT>::integrate_step(uint16_t adc_val,
+                                                    bool center,
+                                                    bool *rx_bit) {
+  if (center) {
+    if (bit_acc_done) {
+      bit_acc_done = false;
+      bit_acc = 0;
+      bit_acc_count = 0;
     }
+    bit_acc += (int32_t)adc_val - mid_level;
+    bit_acc_count++;
+    return false;
+  } else if (!bit_acc_done) {
+    bit_acc_done = true;
+    bit_dist = bit_acc / bit_acc_count;
+    *rx_bit = (bit_acc >= 0);
+    return true;
+  }
+  return false;
+}
+
+// Distance of the decision from the midpoint relative to half the swing,
+// 0 (unreliable) to 255. 0 if the hysteresis made a decision against it.
+template <uint8_t SAMPLES_PER_BIT>
+inline uint8_t RxCdrT<SAMPLES_PER_BIT>::bit_confidence(bool rx_bit) const {
+  if (rx_bit != (bit_dist >= 0) || half_swing == 0) return 0;
+  uint32_t dist = (bit_dist >= 0) ? bit_dist : -bit_dist;
+  uint32_t conf = dist * 255 / half_swing;
+  return conf < 255 ? conf : 255;
+}
+
+// Slices the level of a symbol period with the thresholds from the training.
+// Each symbol carries two bits of the 5b codewords. The first one selects the
+// inner levels (1, 2) or the outer levels (0, 3), and the second one toggles
+// between the lower and upper half, so that the level crosses the middle at
+// least once in 7 symbols for the clock recovery. The first bit is output now
+// and the second one on the next sample.
+template <uint8_t SAMPLES_PER_BIT>
+inline bool RxCdrT<SAMPLES_PER_BIT>::pam4_step(bool *rx_bit,
+                                               uint8_t *rx_conf) {
+  const int32_t level = (int32_t)mid_level + bit_dist;
+  if (pam_state == PamState::TRAINING) {
+    pam_acc[pam_count & 1] += level;
+    if (++pam_count >= PAM4_TRAIN_SYMBOLS) finish_pam4_training();
+    return false;
   }
 
-  int index = (x >> 8) & 0xf;
-  uint16_t a = U16LOG2_TABLE[index];
-  uint16_t b = U16LOG2_TABLE[index + 1];
-  uint16_t q = x & 0xff;
-  uint16_t p = 256 - q;
-  ret += (a * p + b * q) >> 4;
+  const int32_t dist_low = level - pam_low;
+  const int32_t dist_high = pam_high - level;
+  *rx_bit = (dist_low > 0 && dist_high > 0);
+  *rx_conf = pam4_confidence(
+      (dist_low * dist_low < dist_high * dist_high) ? dist_low : dist_high);
 
-  return ret;
+  const bool upper = level >= pam_mid;
+  const uint8_t upper_conf = pam4_confidence(level - pam_mid);
+  pam_pending = true;
+  pam_pending_bit = upper != pam_upper;
+  pam_pending_conf = upper_conf < pam_upper_conf ? upper_conf : pam_upper_conf;
+  pam_upper = upper;
+  pam_upper_conf = upper_conf;
+  return true;
 }
 
-#endif
+// distance from the nearest threshold relative to half the eye
+template <uint8_t SAMPLES_PER_BIT>
+inline uint8_t RxCdrT<SAMPLES_PER_BIT>::pam4_confidence(int32_t dist) const {
+  if (dist < 0) dist = -dist;
+  if (pam_eye == 0) return 0;
+  uint32_t conf = (uint32_t)dist * 255 / pam_eye;
+  return conf < 255 ? conf : 255;
+}
+
+// Places the thresholds between the levels, or falls back to the binary
+// slicer if the levels are too close.
+template <uint8_t SAMPLES_PER_BIT>
+void RxCdrT<SAMPLES_PER_BIT>::finish_pam4_training() {
+  const int32_t n = PAM4_TRAIN_SYMBOLS / 2;
+  const int32_t l0 = (int32_t)mid_level - half_swing;
+  const int32_t l1 = pam_acc[0] / n;
+  const int32_t l2 = pam_acc[1] / n;
+  const int32_t l3 = (int32_t)mid_level + half_swing;
+  int32_t gap = l1 - l0;
+  if (l2 - l1 < gap) gap = l2 - l1;
+  if (l3 - l2 < gap) gap = l3 - l2;
+  if (gap * PAM4_MIN_EYE_DIV < (int32_t)half_swing * 2) {
+    VLCFG_PRINTF("PAM-4 eye too small, levels: %d %d %d %d\n", (int)l0,
+                 (int)l1, (int)l2, (int)l3);
+    pam_state = PamState::OFF;
+    return;
+  }
+
+  pam_low = (l0 + l1) / 2;
+  pam_mid = (l1 + l2) / 2;
+  pam_high = (l2 + l3) / 2;
+  pam_eye = gap / 2;
+  mid_level = pam_mid;
+  threshold = u16log2(pam_mid);
+  // the training ends with level 2
+  pam_upper = true;
+  pam_upper_conf = 255;
+  pam_state = PamState::ACTIVE;
+  VLCFG_PRINTF("PAM-4 started, levels: %d %d %d %d\n", (int)l0, (int)l1,
+               (int)l2, (int)l3);
+}
+
+// Switches the CDR to PAM-4 on the PAM4 marker, and back to binary on the end
+// of the frame or the loss of the symbol lock.
+template <uint8_t SAMPLES_PER_BIT>
+inline void pam4_control(RxCdrT<SAMPLES_PER_BIT> &cdr, const PcsOutput &pcs) {
+  if (pcs.rxed && pcs.rx_byte == SYMBOL_PAM4) {
+    cdr.start_pam4();
+  } else if (pcs.state == PcsState::LOS ||
+             (pcs.rxed && pcs.rx_byte == SYMBOL_EOF)) {
+    cdr.stop_pam4();
+  }
+}
+
+// Switches the CDR to the payload rate on a dual-rate header, and back to the
+// base rate on the end of the frame.
+template <uint8_t SAMPLES_PER_BIT, class PCS>
+inline Result dual_rate_control(RxCdrT<SAMPLES_PER_BIT> &cdr, const PCS &pcs,
+                                const PcsOutput &out) {
+  if (!out.rxed) return Result::SUCCESS;
+  if (out.rx_byte == SYMBOL_RATE) {
+    return cdr.start_dual_rate(pcs.get_rate_mul(), pcs.get_rate_bits());
+  } else if (out.rx_byte == SYMBOL_EOF) {
+    cdr.stop_dual_rate();
+  }
+  return Result::SUCCESS;
+}
 
 }  // namespace vlcfg
 
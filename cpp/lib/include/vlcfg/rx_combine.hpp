@@ -0,0 +1,159 @@
+#ifndef VLCFG_RX_COMBINE_HPP
+#define VLCFG_RX_COMBINE_HPP
+
+#include "vlcfg/common.hpp"
+#include "vlcfg/crc32.hpp"
+#include "vlcfg/rx_buff.hpp"
+
+namespace vlcfg {
+
+// frames combined before starting over, in case the frame has changed
+static constexpr uint8_t MAX_COMBINE_COPIES = 4;
+// least reliable bits tried when the majority fails the CRC
+static constexpr uint8_t MAX_COMBINE_FLIPS = 8;
+
+// Combines the repetitions of a frame that fail the CRC.
+//
+// Each bit of the frame has a sum of votes, +weight for 1 and -weight for 0,
+// where the weight of a byte grows with its soft decision margin. Each failed
+// copy of the same length is added to the votes, and the majority is tried
+// against the CRC, then every combination of the MAX_COMBINE_FLIPS bits with
+// the smallest sums. A copy identical to an earlier one (same CRC of the
+// content) adds no information and is skipped.
+class RxCombiner {
+ private:
+  const uint16_t capacity;
+  int8_t *votes;
+  // weight of each byte of the frame being received
+  uint8_t *weights;
+  uint16_t length = 0;
+  uint8_t num_copies = 0;
+  uint32_t copy_crcs[MAX_COMBINE_COPIES];
+  uint16_t num_duplicates = 0;
+
+ public:
+  inline RxCombiner(int capacity)
+      : capacity(capacity),
+        votes(new int8_t[capacity * 8]),
+        weights(new uint8_t[capacity]) {}
+  inline ~RxCombiner() {
+    delete[] votes;
+    delete[] weights;
+  }
+
+  // Discards the combined copies.
+  inline void init() {
+    length = 0;
+    num_copies = 0;
+  }
+  // Records the weight of byte `pos` of the frame being received.
+  inline void set_weight(uint16_t pos, const PcsOutput *in) {
+    if (pos < capacity) weights[pos] = 1 + (in->rx_margin >> 4);
+  }
+  // Adds the frame in `buff`, which failed the CRC, to the votes. If a
+  // combined frame passes the CRC, it replaces the frame in `buff` and the
+  // CRC is removed.
+  Result combine(RxBuff &buff);
+  inline uint8_t get_num_copies() const { return num_copies; }
+  // number of copies skipped as identical to an earlier one
+  inline uint16_t get_num_duplicates() const { return num_duplicates; }
+
+ private:
+  bool try_flips(RxBuff &buff);
+};
+
+#ifdef VLCFG_IMPLEMENTATION
+
+Result RxCombiner::combine(RxBuff &buff) {
+  const uint16_t len = buff.stored_size();
+  if (len != length || num_copies >= MAX_COMBINE_COPIES) {
+    for (uint16_t i = 0; i < len * 8; i++) {
+      votes[i] = 0;
+    }
+    length = len;
+    num_copies = 0;
+  }
+
+  const uint32_t crc = crc32(buff.buff, len);
+  for (uint8_t i = 0; i < num_copies; i++) {
+    if (copy_crcs[i] == crc) {
+      num_duplicates++;
+      VLCFG_THROW(Result::ERR_BAD_CRC);
+    }
+  }
+  copy_crcs[num_copies++] = crc;
+
+  for (uint16_t pos = 0; pos < len; pos++) {
+    const int8_t w = weights[pos];
+    const uint8_t byte = buff.buff[pos];
+    int8_t *v = votes + pos * 8;
+    for (uint8_t i = 0; i < 8; i++) {
+      int16_t sum = v[i] + (((byte >> i) & 1) ? w : -w);
+      if (sum > 127) sum = 127;
+      if (sum < -127) sum = -127;
+      v[i] = sum;
+    }
+  }
+  VLCFG_PRINTF("Combining %d copies\n", (int)num_copies);
+  if (num_copies < 2) {
+    VLCFG_THROW(Result::ERR_BAD_CRC);
+  }
+
+  // the majority, a tie goes to the last copy
+  for (uint16_t pos = 0; pos < len; pos++) {
+    uint8_t byte = buff.buff[pos];
+    const int8_t *v = votes + pos * 8;
+    for (uint8_t i = 0; i < 8; i++) {
+      if (v[i] > 0) byte |= (1 << i);
+      if (v[i] < 0) byte &= ~(1 << i);
+    }
+    buff.buff[pos] = byte;
+  }
+
+  if (buff.crc_matches() || try_flips(buff)) {
+    VLCFG_PRINTF("Combining succeeded: %d copies\n", (int)num_copies);
+    init();
+    return buff.check_and_remove_crc();
+  }
+  VLCFG_THROW(Result::ERR_BAD_CRC);
+}
+
+// Tries the combinations of the least reliable bits in Gray code order, one
+// flip per CRC check.
+bool RxCombiner::try_flips(RxBuff &buff) {
+  uint16_t bits[MAX_COMBINE_FLIPS];
+  uint8_t num_bits = 0;
+  for (uint16_t i = 0; i < length * 8; i++) {
+    const uint8_t mag = votes[i] < 0 ? -votes[i] : votes[i];
+    uint8_t index = num_bits;
+    if (num_bits >= MAX_COMBINE_FLIPS) {
+      index = 0;
+      uint8_t max_mag = 0;
+      for (uint8_t j = 0; j < num_bits; j++) {
+        const int8_t v = votes[bits[j]];
+        const uint8_t m = v < 0 ? -v : v;
+        if (m > max_mag) {
+          max_mag = m;
+          index = j;
+        }
+      }
+      if (max_mag <= mag) continue;
+    } else {
+      num_bits++;
+    }
+    bits[index] = i;
+  }
+
+  for (uint16_t mask = 1; mask < (1 << num_bits); mask++) {
+    const uint16_t bit = bits[ctz32(mask)];
+    buff.buff[bit / 8] ^= 1 << (bit % 8);
+    if (buff.crc_matches()) return true;
+  }
+  return false;
+}
+
+#endif
+
+}  // namespace vlcfg
+
+#endif
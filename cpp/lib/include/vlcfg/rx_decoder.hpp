@@ -3,6 +3,10 @@
 
 #include "vlcfg/common.hpp"
 #include "vlcfg/rx_buff.hpp"
+#include "vlcfg/rx_cbor.hpp"
+#include "vlcfg/rx_combine.hpp"
+#include "vlcfg/rx_fec.hpp"
+#include "vlcfg/rx_segment.hpp"
 
 namespace vlcfg {
 
@@ -13,27 +17,127 @@ enum class RxState : uint8_t {
   ERROR,
 };
 
+// maximum number of unreliable bytes tried by the Chase decoding
+static constexpr uint8_t MAX_CHASE_DEPTH = 4;
+
+// Frames and errors since the start, saturating at 0xffff. Not cleared by
+// RxDecoder::init().
+struct RxCounters {
+  uint16_t completed;
+  uint16_t errors;
+  // breakdown of `errors`
+  uint16_t bad_crc;
+  uint16_t los;
+  uint16_t overflow;
+  uint16_t timeout;
+};
+
+struct ChaseCandidate {
+  uint16_t pos;
+  // xor to replace the byte with the alternative
+  uint8_t flip;
+  uint8_t margin;
+};
+
 class RxDecoder {
  private:
   RxBuff buff;
+  RxFec fec;
+  RxCborParser parser;
+  RxCombiner* combiner = nullptr;
+  RxSegments segments;
 
   ConfigEntry* entries = nullptr;
   RxState state = RxState::IDLE;
+  bool fec_frame = false;
+  bool streaming = false;
+  uint8_t chase_depth = 0;
+  uint8_t num_chase_cands = 0;
+  ChaseCandidate chase_cands[MAX_CHASE_DEPTH];
+  bool auto_rearm = false;
+  uint32_t frame_timeout_us = 0;
+  uint32_t frame_us = 0;
+  Result last_error = Result::SUCCESS;
+  RxCounters counters = {};
 
  public:
   inline RxDecoder(int capacity) : buff(capacity) { buff.init(); }
+  inline ~RxDecoder() { delete combiner; }
 
   void init(ConfigEntry* dst);
   Result update(PcsOutput* in, RxState* rx_state);
+  // Advances the frame timer by `elapsed_us`, called by the receivers once per
+  // sample.
+  Result update_timer(uint32_t elapsed_us, RxState* rx_state);
   inline RxState get_state() const { return state; }
+  // Discards the partial frame and the received entries, and hunts for the
+  // next SOF. The stored segments are kept.
+  void rearm();
+  // Rearms on the update after an error, so that the next frame of a looping
+  // transmitter is received without init().
+  inline void set_auto_rearm(bool enable) { auto_rearm = enable; }
+  inline bool get_auto_rearm() const { return auto_rearm; }
+  // Throws ERR_TIMEOUT when the EOF does not arrive within `ms` after the SOF,
+  // 0 disables the timeout.
+  Result set_frame_timeout_ms(uint32_t ms);
+  inline uint32_t get_frame_timeout_ms() const {
+    return frame_timeout_us / 1000;
+  }
+  // time left until the frame times out, 0 if the timer is not running
+  inline uint32_t get_timer_remaining_us() const {
+    if (state != RxState::RECEIVING || frame_timeout_us == 0) return 0;
+    return frame_us < frame_timeout_us ? frame_timeout_us - frame_us : 1;
+  }
+  inline Result get_last_error() const { return last_error; }
+  inline const RxCounters& get_counters() const { return counters; }
+  inline void clear_counters() { counters = RxCounters(); }
+  // Counts an error of the stage in front of the decoder.
+  void count_error(Result res);
   inline ConfigEntry* entry_from_key(const char* key) const {
     return vlcfg::entry_from_key(entries, key);
   }
-  inline uint16_t get_received_size() const { return buff.stored_size(); }
+  inline uint16_t get_received_size() const {
+    return streaming ? parser.get_size() : buff.stored_size();
+  }
+  // Parses the frame as it arrives with RxCborParser instead of buffering it.
+  // The buffer only needs room for one group of the FEC frames, and can be
+  // empty without FEC. The Chase decoding is not available. The values are
+  // kept in `staging` until the CRC is checked, see
+  // RxCborParser::staging_size(). Without it, they are written in place and
+  // the entries are undefined after a failed frame.
+  inline void set_streaming(bool enable, uint8_t* staging = nullptr,
+                            uint16_t staging_size = 0) {
+    streaming = enable;
+    parser.set_staging(enable ? staging : nullptr, staging_size);
+  }
+  inline bool get_streaming() const { return streaming; }
+  // On a CRC error, tries the alternatives from the soft decision RxPcs for
+  // up to `depth` least reliable bytes.
+  Result set_chase_depth(uint8_t depth);
+  inline uint8_t get_chase_depth() const { return chase_depth; }
+  // Combines the repetitions of a frame that fail the CRC (not FEC frames, and
+  // not in the streaming mode). Needs 9 bytes of RAM per buffer byte.
+  void set_combining(bool enable);
+  inline bool get_combining() const { return combiner != nullptr; }
+  inline const RxCombiner* get_combiner() const { return combiner; }
+  // Assembles the segment frames in `buff`, nullptr disables them. The
+  // payload (CBOR object and CRC32) has to fit in `size` bytes, the receive
+  // buffer only needs room for one segment frame. Not in the streaming mode.
+  inline void set_segment_buffer(uint8_t* buff, uint16_t size) {
+    segments.set_buffer(buff, size);
+  }
+  inline const RxSegments& get_segments() const { return segments; }
+  // Reed-Solomon decoder of the last FEC frame
+  inline const RxFec& get_fec() const { return fec; }
 
  private:
   Result update_state(PcsOutput* in);
-  Result rx_complete();
+  void add_chase_candidate(const PcsOutput* in);
+  Result chase_decode();
+  Result stream_corrected();
+  void wait_next_frame();
+  Result rx_complete(bool* completed);
+  Result parse_segments();
   Result read_key(int16_t* entry_index);
   Result read_value(ConfigEntry* entry);
 };
@@ -41,8 +145,15 @@ class RxDecoder {
 #ifdef VLCFG_IMPLEMENTATION
 
 void RxDecoder::init(ConfigEntry* entries) {
-  this->buff.init();
   this->entries = entries;
+  rearm();
+  if (combiner) combiner->init();
+  segments.init();
+  this->last_error = Result::SUCCESS;
+  VLCFG_PRINTF("RX Decoder initialized.\n");
+}
+
+void RxDecoder::rearm() {
   if (entries) {
     for (uint8_t i = 0; i < MAX_ENTRY_COUNT; i++) {
       ConfigEntry& entry = entries[i];
@@ -51,14 +162,72 @@ void RxDecoder::init(ConfigEntry* entries) {
       entry.received = 0;
     }
   }
+  wait_next_frame();
+}
+
+void RxDecoder::wait_next_frame() {
+  this->buff.init();
   this->state = RxState::IDLE;
-  VLCFG_PRINTF("RX Decoder initialized.\n");
+  this->fec_frame = false;
+  this->num_chase_cands = 0;
+  this->frame_us = 0;
+}
+
+static inline void count_up(uint16_t* count) {
+  if (*count < 0xffff) (*count)++;
+}
+
+void RxDecoder::count_error(Result res) {
+  last_error = res;
+  count_up(&counters.errors);
+  switch (res) {
+    case Result::ERR_BAD_CRC: count_up(&counters.bad_crc); break;
+    case Result::ERR_LOS: count_up(&counters.los); break;
+    case Result::ERR_OVERFLOW: count_up(&counters.overflow); break;
+    case Result::ERR_TIMEOUT: count_up(&counters.timeout); break;
+    default: break;
+  }
+}
+
+Result RxDecoder::set_chase_depth(uint8_t depth) {
+  if (depth > MAX_CHASE_DEPTH) {
+    VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+  }
+  chase_depth = depth;
+  num_chase_cands = 0;
+  return Result::SUCCESS;
+}
+
+void RxDecoder::set_combining(bool enable) {
+  if (enable && combiner == nullptr) {
+    combiner = new RxCombiner(buff.capacity);
+    combiner->init();
+  } else if (!enable && combiner != nullptr) {
+    delete combiner;
+    combiner = nullptr;
+  }
+}
+
+Result RxDecoder::set_frame_timeout_ms(uint32_t ms) {
+  if (ms > UINT32_MAX / 1000) {
+    VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+  }
+  frame_timeout_us = ms * 1000;
+  return Result::SUCCESS;
 }
 
 Result RxDecoder::update(PcsOutput* in, RxState* rx_state) {
+  if (state == RxState::ERROR && auto_rearm) {
+    VLCFG_PRINTF("RX Decoder rearmed.\n");
+    rearm();
+  }
+  const RxState last_state = state;
   Result ret = update_state(in);
   if (ret != Result::SUCCESS) {
     state = RxState::ERROR;
+    count_error(ret);
+  } else if (state == RxState::COMPLETED && last_state != state) {
+    count_up(&counters.completed);
   }
   if (rx_state) {
     *rx_state = state;
@@ -66,10 +235,29 @@ Result RxDecoder::update(PcsOutput* in, RxState* rx_state) {
   return ret;
 }
 
+Result RxDecoder::update_timer(uint32_t elapsed_us, RxState* rx_state) {
+  if (state == RxState::RECEIVING && frame_timeout_us > 0) {
+    frame_us += elapsed_us;
+    if (frame_us >= frame_timeout_us) {
+      state = RxState::ERROR;
+      count_error(Result::ERR_TIMEOUT);
+      if (rx_state) *rx_state = state;
+      VLCFG_THROW(Result::ERR_TIMEOUT);
+    }
+  }
+  if (rx_state) *rx_state = state;
+  return Result::SUCCESS;
+}
+
 Result RxDecoder::update_state(PcsOutput* in) {
   switch (state) {
     case RxState::IDLE:
-      if (in->rxed && in->rx_byte == SYMBOL_SOF) {
+      if (in->rxed &&
+          (in->rx_byte == SYMBOL_SOF || in->rx_byte == SYMBOL_SOF_FEC)) {
+        fec_frame = (in->rx_byte == SYMBOL_SOF_FEC);
+        fec.init();
+        parser.init(entries);
+        frame_us = 0;
         state = RxState::RECEIVING;
       }
       break;
@@ -79,11 +267,34 @@ Result RxDecoder::update_state(PcsOutput* in) {
         VLCFG_THROW(Result::ERR_LOS);
       } else if (in->rxed) {
         if (in->rx_byte == SYMBOL_EOF) {
-          VLCFG_TRY(rx_complete());
+          if (fec_frame) VLCFG_TRY(fec.finish(buff));
+          if (streaming) {
+            if (fec_frame) VLCFG_TRY(stream_corrected());
+            VLCFG_TRY(parser.finish());
+          } else {
+            bool completed;
+            VLCFG_TRY(rx_complete(&completed));
+            if (!completed) {
+              // a segment of a larger payload
+              wait_next_frame();
+              break;
+            }
+          }
           state = RxState::COMPLETED;
         } else if (0 <= in->rx_byte && in->rx_byte <= 255) {
           VLCFG_PRINTF("rxed: 0x%02X\n", (int)in->rx_byte);
-          VLCFG_TRY(buff.push(in->rx_byte));
+          if (fec_frame) {
+            // the parity bytes are removed from the buffer, which would
+            // invalidate the positions of the Chase candidates
+            VLCFG_TRY(fec.push(in->rx_byte, buff));
+            if (streaming) VLCFG_TRY(stream_corrected());
+          } else if (streaming) {
+            VLCFG_TRY(parser.push(in->rx_byte));
+          } else {
+            add_chase_candidate(in);
+            if (combiner) combiner->set_weight(buff.stored_size(), in);
+            VLCFG_TRY(buff.push(in->rx_byte));
+          }
         } else {
           VLCFG_THROW(Result::ERR_EOF_EXPECTED);
         }
@@ -95,7 +306,55 @@ Result RxDecoder::update_state(PcsOutput* in) {
   return Result::SUCCESS;
 }
 
-Result RxDecoder::rx_complete() {
+// keeps the bytes with the smallest margins
+void RxDecoder::add_chase_candidate(const PcsOutput* in) {
+  if (chase_depth == 0 || in->rx_alt == in->rx_byte) return;
+  uint8_t index = num_chase_cands;
+  if (num_chase_cands >= chase_depth) {
+    index = 0;
+    for (uint8_t i = 1; i < num_chase_cands; i++) {
+      if (chase_cands[i].margin > chase_cands[index].margin) index = i;
+    }
+    if (chase_cands[index].margin <= in->rx_margin) return;
+  } else {
+    num_chase_cands++;
+  }
+  ChaseCandidate& cand = chase_cands[index];
+  cand.pos = buff.stored_size();
+  cand.flip = in->rx_byte ^ in->rx_alt;
+  cand.margin = in->rx_margin;
+}
+
+// Tries every combination of the alternatives until the CRC matches.
+Result RxDecoder::chase_decode() {
+  for (uint8_t mask = 1; mask < (1 << num_chase_cands); mask++) {
+    for (uint8_t i = 0; i < num_chase_cands; i++) {
+      if (mask & (1 << i)) buff.buff[chase_cands[i].pos] ^= chase_cands[i].flip;
+    }
+    if (buff.crc_matches()) {
+      VLCFG_PRINTF("Chase decoding succeeded: mask=0x%X\n", (int)mask);
+      return buff.check_and_remove_crc();
+    }
+    for (uint8_t i = 0; i < num_chase_cands; i++) {
+      if (mask & (1 << i)) buff.buff[chase_cands[i].pos] ^= chase_cands[i].flip;
+    }
+  }
+  VLCFG_THROW(Result::ERR_BAD_CRC);
+}
+
+// Passes the corrected bytes of the FEC frame to the parser.
+Result RxDecoder::stream_corrected() {
+  const uint16_t size = fec.get_corrected_size();
+  if (size == 0) return Result::SUCCESS;
+  for (uint16_t i = 0; i < size; i++) {
+    VLCFG_TRY(parser.push(buff[i]));
+  }
+  fec.release(buff);
+  return Result::SUCCESS;
+}
+
+Result RxDecoder::rx_complete(bool* completed) {
+  *completed = true;
   VLCFG_PRINTF("%d bytes received.\n", (int)buff.queued_size());
   // #ifdef VLCFG_DEBUG
   //   VLCFG_PRINTF("buffer content:\n");
@@ -104,7 +363,20 @@ Result RxDecoder::rx_complete() {
   //   }
   // #endif
 
-  VLCFG_TRY(buff.check_and_remove_crc());
+  Result ret = buff.check_and_remove_crc();
+  if (ret == Result::ERR_BAD_CRC && num_chase_cands > 0) {
+    ret = chase_decode();
+  }
+  if (ret == Result::ERR_BAD_CRC && combiner && !fec_frame) {
+    ret = combiner->combine(buff);
+  }
+  VLCFG_TRY(ret);
+
+  if (segments.enabled() && buff.peek(0) == SEGMENT_MARKER) {
+    VLCFG_TRY(segments.store(buff, completed));
+    if (*completed) VLCFG_TRY(parse_segments());
+    return Result::SUCCESS;
+  }
 
   CborMajorType mtype;
   uint64_t param;
@@ -142,6 +414,36 @@ Result RxDecoder::rx_complete() {
   return Result::SUCCESS;
 }
 
+// Parses the assembled payload, and starts over if it is not valid.
+Result RxDecoder::parse_segments() {
+  VLCFG_PRINTF("All %d segments received.\n", (int)segments.get_count());
+  const uint8_t* payload = segments.get_payload();
+  const uint16_t len = segments.get_length();
+  // the CRC is checked first, so that a broken payload leaves the entries as
+  // they are
+  bool crc_ok = false;
+  if (len >= 4) {
+    const uint16_t size = len - 4;
+    const uint32_t recvCrc = static_cast<uint32_t>(payload[size]) << 24 |
+                             static_cast<uint32_t>(payload[size + 1]) << 16 |
+                             static_cast<uint32_t>(payload[size + 2]) << 8 |
+                             static_cast<uint32_t>(payload[size + 3]);
+    crc_ok = crc32(payload, size) == recvCrc;
+  }
+  if (!crc_ok) {
+    segments.init();
+    VLCFG_THROW(Result::ERR_BAD_CRC);
+  }
+  parser.init(entries);
+  Result ret = Result::SUCCESS;
+  for (uint16_t i = 0; i < len && ret == Result::SUCCESS; i++) {
+    ret = parser.push(payload[i]);
+  }
+  if (ret == Result::SUCCESS) ret = parser.finish();
+  if (ret != Result::SUCCESS) segments.init();
+  return ret;
+}
+
 Result RxDecoder::read_key(int16_t* entry_index) {
   // read key
   CborMajorType mtype;
@@ -178,72 +480,17 @@ Result RxDecoder::read_value(ConfigEntry* entry) {
 
   switch (mtype) {
     case CborMajorType::UNSIGNED_INT:
-    case CborMajorType::NEGATIVE_INT: {
-      if (entry) {
-        uint8_t buff_req = 0;
-        bool rx_pos = mtype == CborMajorType::UNSIGNED_INT;
-        bool rx_neg = mtype == CborMajorType::NEGATIVE_INT;
-        bool rx_msb = (param & 0x8000000000000000) != 0;
-        if (entry->type == ValueType::UINT) {
-          if (rx_neg) VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
-          if (param & 0xFFFFFFFF00000000) {
-            buff_req = 8;
-          } else if (param & 0x00000000FFFF0000) {
-            buff_req = 4;
-          } else if (param & 0x000000000000FF00) {
-            buff_req = 2;
-          } else {
-            buff_req = 1;
-          }
-        } else if (entry->type == ValueType::INT) {
-          if (rx_pos && rx_msb) VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
-          if (rx_neg && rx_msb) VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
-          if (param & 0xFFFFFFFF80000000) {
-            buff_req = 8;
-          } else if (param & 0x000000007FFF8000) {
-            buff_req = 4;
-          } else if (param & 0x0000000000007F80) {
-            buff_req = 2;
-          } else {
-            buff_req = 1;
-          }
-          if (rx_neg) {
-            param = static_cast<uint64_t>(-static_cast<int64_t>(param) - 1);
-          }
-        } else {
-          VLCFG_THROW(Result::ERR_VALUE_TYPE_MISMATCH);
-        }
-
-        if (buff_req > entry->capacity) {
-          VLCFG_THROW(Result::ERR_VALUE_TOO_LONG);
-        }
-        void* dst = entry->buffer;
-        switch (entry->capacity) {
-          case 1: *(uint8_t*)dst = static_cast<uint8_t>(param); break;
-          case 2: *(uint16_t*)dst = static_cast<uint16_t>(param); break;
-          case 4: *(uint32_t*)dst = static_cast<uint32_t>(param); break;
-          case 8: *(uint64_t*)dst = static_cast<uint64_t>(param); break;
-          default: VLCFG_THROW(Result::ERR_BUFF_SIZE_MISMATCH);
-        }
-        entry->received = entry->capacity;
-      }
-    } break;
+    case CborMajorType::NEGATIVE_INT:
+      if (entry) VLCFG_TRY(store_integer(entry, mtype, param));
+      break;
 
     case CborMajorType::BYTE_STR:
     case CborMajorType::TEXT_STR: {
       bool is_text = (mtype == CborMajorType::TEXT_STR);
       uint16_t len = param;
       if (entry != nullptr) {
-        ValueType exp_value_type =
-            is_text ? ValueType::TEXT_STR : ValueType::BYTE_STR;
-        if (entry->type != exp_value_type) {
-          VLCFG_THROW(Result::ERR_VALUE_TYPE_MISMATCH);
-        }
-
-        uint16_t buff_req = is_text ? len + 1 : len;
-        if (buff_req > entry->capacity) {
-          VLCFG_THROW(Result::ERR_VALUE_TOO_LONG);
-        }
+        uint16_t buff_req;
+        VLCFG_TRY(check_string(entry, is_text, param, &buff_req));
         uint8_t* dst = (uint8_t*)entry->buffer;
         VLCFG_TRY(buff.popBytes(dst, len));
         if (is_text) {
@@ -256,22 +503,9 @@ Result RxDecoder::read_value(ConfigEntry* entry) {
       }
     } break;
 
-    case CborMajorType::SIMPLE_OR_FLOAT: {
-      if (param == 20 || param == 21) {
-        if (entry != nullptr) {
-          if (entry->capacity != 1) {
-            VLCFG_THROW(Result::ERR_BUFF_SIZE_MISMATCH);
-          }
-          bool value = (param == 20) ? false : true;
-          *((uint8_t*)entry->buffer) = value ? 1 : 0;
-          entry->received = 1;
-          VLCFG_PRINTF("boolean value: %s\n", value ? "true" : "false");
-        }
-      } else {
-        VLCFG_THROW(Result::ERR_UNSUPPORTED_TYPE);
-      }
-
-    } break;
+    case CborMajorType::SIMPLE_OR_FLOAT:
+      if (entry) VLCFG_TRY(store_boolean(entry, param));
+      break;
 
     default: VLCFG_THROW(Result::ERR_UNSUPPORTED_TYPE);
   }
@@ -0,0 +1,345 @@
+#ifndef VLCFG_RX_FEC_HPP
+#define VLCFG_RX_FEC_HPP
+
+#include "vlcfg/common.hpp"
+#include "vlcfg/rx_buff.hpp"
+
+// Exponent and logarithm tables of GF(2^8). Needs C++14 constexpr to be
+// generated at compile time, and is disabled on AVR where const tables are
+// placed in RAM.
+#ifndef VLCFG_FEC_LUT
+#if (__cplusplus >= 201402L) && !defined(__AVR__)
+#define VLCFG_FEC_LUT (1)
+#else
+#define VLCFG_FEC_LUT (0)
+#endif
+#endif
+
+namespace vlcfg {
+
+// data bytes per codeword, except for the last group of the frame
+static constexpr uint8_t FEC_DATA_LEN = 32;
+static constexpr uint8_t MAX_FEC_DEPTH = 8;
+static constexpr uint8_t MAX_FEC_PARITY = 15;
+static constexpr uint8_t MIN_FEC_PARITY = 2;
+// the header byte is sent three times and decided by the bitwise majority
+static constexpr uint8_t FEC_HEADER_COPIES = 3;
+
+// Reed-Solomon decoder for the FEC frames (CTRL SOF_FEC).
+//
+// The frame starts with a header byte, (depth << 4) | parity, followed by
+// the payload in groups. A group carries up to `depth * FEC_DATA_LEN` data
+// bytes, then `depth * parity` parity bytes. Byte `t` of a group belongs to
+// codeword `t % depth`, so a burst error of `depth` bytes hits each codeword
+// only once, and each codeword corrects up to `parity / 2` bytes. The data
+// bytes come in order and go straight to the buffer. The syndromes are
+// updated as each byte arrives, and a group is corrected in place as soon as
+// its last parity byte (or EOF) arrives.
+class RxFec {
+ private:
+  uint8_t header[FEC_HEADER_COPIES];
+  uint8_t header_len;
+  uint8_t depth;
+  uint8_t parity;
+  uint8_t codeword;
+  uint16_t group_start;
+  uint16_t group_len;
+  uint8_t alpha_pow[MAX_FEC_PARITY];
+  uint8_t syndromes[MAX_FEC_DEPTH][MAX_FEC_PARITY];
+  uint16_t num_corrected;
+  uint16_t num_failed;
+
+ public:
+  inline RxFec() { init(); }
+  void init();
+  Result push(uint8_t byte, RxBuff &buff);
+  Result finish(RxBuff &buff);
+  inline uint8_t get_depth() const { return depth; }
+  inline uint8_t get_parity() const { return parity; }
+  // number of bytes corrected in the frame
+  inline uint16_t get_num_corrected() const { return num_corrected; }
+  // number of codewords with too many errors in the frame
+  inline uint16_t get_num_failed() const { return num_failed; }
+  // number of corrected data bytes at the start of the buffer
+  inline uint16_t get_corrected_size() const { return group_start; }
+  // Removes the corrected data bytes from the buffer, so that it only needs
+  // room for one group.
+  void release(RxBuff &buff);
+
+ private:
+  Result parse_header();
+  void start_group(RxBuff &buff);
+  void end_group(RxBuff &buff);
+  bool correct(RxBuff &buff, uint8_t index, uint8_t len, uint16_t data_len);
+};
+
+#ifdef VLCFG_IMPLEMENTATION
+
+static constexpr uint16_t GF_POLY = 0x11d;
+
+#if VLCFG_FEC_LUT
+struct GfLut {
+  uint8_t exp[512];
+  uint8_t log[256];
+  constexpr GfLut() : exp(), log() {
+    uint16_t x = 1;
+    for (uint16_t i = 0; i < 255; i++) {
+      exp[i] = x;
+      exp[i + 255] = x;
+      log[x] = i;
+      x <<= 1;
+      if (x & 0x100) x ^= GF_POLY;
+    }
+  }
+};
+
+static constexpr GfLut GF_LUT;
+#endif
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b) {
+#if VLCFG_FEC_LUT
+  if (a == 0 || b == 0) return 0;
+  return GF_LUT.exp[GF_LUT.log[a] + GF_LUT.log[b]];
+#else
+  uint8_t p = 0;
+  while (b) {
+    if (b & 1) p ^= a;
+    a = (a << 1) ^ ((a & 0x80) ? (GF_POLY & 0xff) : 0);
+    b >>= 1;
+  }
+  return p;
+#endif
+}
+
+// alpha^e
+static uint8_t gf_alpha(uint16_t e) {
+  e %= 255;
+#if VLCFG_FEC_LUT
+  return GF_LUT.exp[e];
+#else
+  uint8_t x = 1, a = 2;
+  for (; e; e >>= 1) {
+    if (e & 1) x = gf_mul(x, a);
+    a = gf_mul(a, a);
+  }
+  return x;
+#endif
+}
+
+static uint8_t gf_inv(uint8_t a) {
+#if VLCFG_FEC_LUT
+  return GF_LUT.exp[255 - GF_LUT.log[a]];
+#else
+  // a^254
+  uint8_t x = 1;
+  for (uint8_t i = 0; i < 7; i++) {
+    a = gf_mul(a, a);
+    x = gf_mul(x, a);
+  }
+  return x;
+#endif
+}
+
+// evaluates the polynomial `p` of degree `deg` (p[0] is the constant term)
+static uint8_t gf_poly_eval(const uint8_t *p, uint8_t deg, uint8_t x) {
+  uint8_t y = p[deg];
+  for (int8_t i = deg - 1; i >= 0; i--) {
+    y = gf_mul(y, x) ^ p[i];
+  }
+  return y;
+}
+
+void RxFec::init() {
+  header_len = 0;
+  depth = 0;
+  parity = 0;
+  group_start = 0;
+  group_len = 0;
+  num_corrected = 0;
+  num_failed = 0;
+}
+
+Result RxFec::push(uint8_t byte, RxBuff &buff) {
+  if (header_len < FEC_HEADER_COPIES) {
+    header[header_len++] = byte;
+    if (header_len == FEC_HEADER_COPIES) {
+      VLCFG_TRY(parse_header());
+      start_group(buff);
+    }
+    return Result::SUCCESS;
+  }
+
+  VLCFG_TRY(buff.push(byte));
+
+  // syndrome i is the codeword evaluated at alpha^i, in Horner's method
+  uint8_t *s = syndromes[codeword];
+  for (uint8_t i = 0; i < parity; i++) {
+    s[i] = gf_mul(s[i], alpha_pow[i]) ^ byte;
+  }
+  if (++codeword >= depth) codeword = 0;
+
+  if (++group_len >= (uint16_t)depth * (FEC_DATA_LEN + parity)) {
+    end_group(buff);
+  }
+  return Result::SUCCESS;
+}
+
+// Corrects the last group on EOF.
+Result RxFec::finish(RxBuff &buff) {
+  if (header_len < FEC_HEADER_COPIES) {
+    VLCFG_THROW(Result::ERR_UNEXPECTED_EOF);
+  }
+  if (group_len == 0) return Result::SUCCESS;
+  if (group_len < (uint16_t)depth * parity) {
+    VLCFG_THROW(Result::ERR_UNEXPECTED_EOF);
+  }
+  end_group(buff);
+  return Result::SUCCESS;
+}
+
+void RxFec::release(RxBuff &buff) {
+  const uint16_t pending = buff.stored_size() - group_start;
+  for (uint16_t i = 0; i < pending; i++) {
+    buff.buff[i] = buff.buff[group_start + i];
+  }
+  buff.write_pos = pending;
+  buff.read_pos = 0;
+  group_start = 0;
+}
+
+Result RxFec::parse_header() {
+  const uint8_t a = header[0], b = header[1], c = header[2];
+  const uint8_t h = (a & b) | (a & c) | (b & c);
+  depth = h >> 4;
+  parity = h & 0xf;
+  if (depth < 1 || MAX_FEC_DEPTH < depth || parity < MIN_FEC_PARITY) {
+    VLCFG_THROW(Result::ERR_BAD_FEC_HEADER);
+  }
+  for (uint8_t i = 0; i < parity; i++) {
+    alpha_pow[i] = gf_alpha(i);
+  }
+  VLCFG_PRINTF("FEC depth=%d, parity=%d\n", (int)depth, (int)parity);
+  return Result::SUCCESS;
+}
+
+void RxFec::start_group(RxBuff &buff) {
+  group_start = buff.stored_size();
+  group_len = 0;
+  codeword = 0;
+  for (uint8_t j = 0; j < depth; j++) {
+    for (uint8_t i = 0; i < parity; i++) {
+      syndromes[j][i] = 0;
+    }
+  }
+}
+
+// Corrects the data bytes of the group and removes the parity bytes.
+void RxFec::end_group(RxBuff &buff) {
+  const uint16_t parity_len = (uint16_t)depth * parity;
+  const uint16_t data_len = group_len - parity_len;
+  for (uint8_t j = 0; j < depth; j++) {
+    const uint8_t len = (group_len - j + depth - 1) / depth;
+    if (!correct(buff, j, len, data_len)) {
+      num_failed++;
+      VLCFG_PRINTF("FEC failed: codeword %d\n", (int)j);
+    }
+  }
+  buff.write_pos -= parity_len;
+  start_group(buff);
+}
+
+// Corrects codeword `index` of `len` bytes with the Berlekamp-Massey
+// algorithm, the Chien search and the Forney algorithm. Returns false if the
+// errors are beyond the capability.
+bool RxFec::correct(RxBuff &buff, uint8_t index, uint8_t len,
+                    uint16_t data_len) {
+  const uint8_t *s = syndromes[index];
+  bool has_error = false;
+  for (uint8_t i = 0; i < parity; i++) {
+    if (s[i]) has_error = true;
+  }
+  if (!has_error) return true;
+
+  // error locator polynomial
+  uint8_t lambda[MAX_FEC_PARITY + 1] = {1};
+  uint8_t prev[MAX_FEC_PARITY + 1] = {1};
+  uint8_t deg = 0, shift = 1, prev_d = 1;
+  for (uint8_t r = 0; r < parity; r++) {
+    uint8_t d = s[r];
+    for (uint8_t i = 1; i <= deg; i++) {
+      d ^= gf_mul(lambda[i], s[r - i]);
+    }
+    if (d == 0) {
+      shift++;
+      continue;
+    }
+    uint8_t tmp[MAX_FEC_PARITY + 1];
+    for (uint8_t i = 0; i <= parity; i++) tmp[i] = lambda[i];
+    const uint8_t coef = gf_mul(d, gf_inv(prev_d));
+    for (uint8_t i = 0; i + shift <= parity; i++) {
+      lambda[i + shift] ^= gf_mul(coef, prev[i]);
+    }
+    if (deg * 2 <= r) {
+      deg = r + 1 - deg;
+      for (uint8_t i = 0; i <= parity; i++) prev[i] = tmp[i];
+      prev_d = d;
+      shift = 1;
+    } else {
+      shift++;
+    }
+  }
+  if (deg * 2 > parity) return false;
+
+  // error evaluator polynomial, omega = s * lambda mod x^parity
+  uint8_t omega[MAX_FEC_PARITY];
+  for (uint8_t k = 0; k < parity; k++) {
+    omega[k] = 0;
+    for (uint8_t i = 0; i <= deg && i <= k; i++) {
+      omega[k] ^= gf_mul(lambda[i], s[k - i]);
+    }
+  }
+
+  // byte `pos` of the codeword is the coefficient of x^(len - 1 - pos)
+  uint8_t err_pos[MAX_FEC_PARITY / 2];
+  uint8_t err_val[MAX_FEC_PARITY / 2];
+  uint8_t num_errors = 0;
+  for (uint8_t pos = 0; pos < len; pos++) {
+    const uint8_t e = len - 1 - pos;
+    const uint8_t x_inv = gf_alpha(255 - e);
+    if (gf_poly_eval(lambda, deg, x_inv) != 0) continue;
+    if (num_errors >= deg) return false;
+
+    // formal derivative of lambda has the odd terms only
+    uint8_t den = 0;
+    const uint8_t x_inv2 = gf_mul(x_inv, x_inv);
+    uint8_t x_pow = 1;
+    for (uint8_t i = 1; i <= deg; i += 2) {
+      den ^= gf_mul(lambda[i], x_pow);
+      x_pow = gf_mul(x_pow, x_inv2);
+    }
+    if (den == 0) return false;
+    const uint8_t num = gf_poly_eval(omega, parity - 1, x_inv);
+    err_pos[num_errors] = pos;
+    err_val[num_errors] = gf_mul(gf_alpha(e), gf_mul(num, gf_inv(den)));
+    num_errors++;
+  }
+  if (num_errors != deg) return false;
+
+  // the errors in the parity bytes are not worth fixing
+  for (uint8_t i = 0; i < num_errors; i++) {
+    const uint16_t t = (uint16_t)err_pos[i] * depth + index;
+    if (t < data_len) {
+      buff.buff[group_start + t] ^= err_val[i];
+      num_corrected++;
+    }
+  }
+  VLCFG_PRINTF("FEC corrected %d bytes in codeword %d\n", (int)num_errors,
+               (int)index);
+  return true;
+}
+
+#endif
+
+}  // namespace vlcfg
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef VLCFG_RX_FILTER_HPP
+#define VLCFG_RX_FILTER_HPP
+
+#include "vlcfg/common.hpp"
+
+namespace vlcfg {
+
+// Front-end filters for the ADC samples, applied before the CDR.
+// All filters have the same interface:
+// - `bool update(uint16_t in, uint16_t *out)` returns true when `out` is
+//   written.
+// - `size_t process(const uint16_t *in, size_t n, uint16_t *out)` returns the
+//   number of output samples. `in` and `out` may be the same buffer.
+
+template <class Filter>
+inline size_t filter_block(Filter &filter, const uint16_t *in, size_t n,
+                           uint16_t *out) {
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (filter.update(in[i], out + m)) m++;
+  }
+  return m;
+}
+
+// Sliding median of N samples, outputs one sample every DECIM inputs.
+// MedianFilter<3, 3> is equivalent to median3() of three successive reads.
+template <uint8_t N, uint8_t DECIM = 1>
+class MedianFilter {
+ private:
+  static_assert(N % 2 == 1 && N <= 31, "N must be an odd number up to 31.");
+  static_assert(DECIM >= 1, "DECIM must be 1 or more.");
+
+  uint16_t history[N];
+  uint16_t sorted[N];
+  uint8_t wr_index;
+  uint8_t count;
+  uint8_t decim_count;
+
+ public:
+  inline MedianFilter() { init(); }
+
+  inline void init() {
+    wr_index = 0;
+    count = 0;
+    decim_count = 0;
+  }
+
+  inline bool update(uint16_t in, uint16_t *out) {
+    uint8_t i;
+    if (count < N) {
+      i = count++;
+    } else {
+      // replace the oldest sample
+      const uint16_t old = history[wr_index];
+      i = 0;
+      while (sorted[i] != old) i++;
+      for (; i + 1 < N && sorted[i + 1] < in; i++) {
+        sorted[i] = sorted[i + 1];
+      }
+    }
+    for (; i > 0 && sorted[i - 1] > in; i--) {
+      sorted[i] = sorted[i - 1];
+    }
+    sorted[i] = in;
+    history[wr_index] = in;
+    wr_index = (wr_index + 1 < N) ? (wr_index + 1) : 0;
+
+    if (++decim_count < DECIM) return false;
+    decim_count = 0;
+    *out = sorted[count / 2];
+    return true;
+  }
+
+  inline size_t process(const uint16_t *in, size_t n, uint16_t *out) {
+    return filter_block(*this, in, n, out);
+  }
+};
+
+// Moving average over `length` samples (up to MAX_LENGTH).
+// Setting the length to one flicker period (sample rate / flicker frequency)
+// nulls the flicker and all of its harmonics.
+template <uint16_t MAX_LENGTH>
+class BoxcarFilter {
+ private:
+  static_assert(MAX_LENGTH >= 1, "MAX_LENGTH must be 1 or more.");
+
+  uint16_t history[MAX_LENGTH];
+  uint16_t length = MAX_LENGTH;
+  uint16_t wr_index;
+  uint16_t count;
+  uint32_t sum;
+
+ public:
+  inline BoxcarFilter() { init(); }
+
+  inline void init() {
+    wr_index = 0;
+    count = 0;
+    sum = 0;
+  }
+
+  inline Result set_length(uint16_t length) {
+    if (length == 0 || MAX_LENGTH < length) {
+      VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+    }
+    this->length = length;
+    init();
+    return Result::SUCCESS;
+  }
+  inline uint16_t get_length() const { return length; }
+
+  inline bool update(uint16_t in, uint16_t *out) {
+    if (count < length) {
+      count++;
+    } else {
+      sum -= history[wr_index];
+    }
+    sum += in;
+    history[wr_index] = in;
+    wr_index = (wr_index + 1 < length) ? (wr_index + 1) : 0;
+    *out = sum / count;
+    return true;
+  }
+
+  inline size_t process(const uint16_t *in, size_t n, uint16_t *out) {
+    return filter_block(*this, in, n, out);
+  }
+};
+
+// Comb filter: y[n] = (x[n] + x[n - delay]) / 2.
+// Setting the delay to half a flicker period nulls the flicker and its odd
+// harmonics (e.g. PWM backlight at 50% duty) with a shorter smear than
+// BoxcarFilter.
+template <uint16_t MAX_DELAY>
+class CombFilter {
+ private:
+  static_assert(MAX_DELAY >= 1, "MAX_DELAY must be 1 or more.");
+
+  uint16_t history[MAX_DELAY];
+  uint16_t delay = MAX_DELAY;
+  uint16_t wr_index;
+  uint16_t count;
+
+ public:
+  inline CombFilter() { init(); }
+
+  inline void init() {
+    wr_index = 0;
+    count = 0;
+  }
+
+  inline Result set_delay(uint16_t delay) {
+    if (delay == 0 || MAX_DELAY < delay) {
+      VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+    }
+    this->delay = delay;
+    init();
+    return Result::SUCCESS;
+  }
+  inline uint16_t get_delay() const { return delay; }
+
+  inline bool update(uint16_t in, uint16_t *out) {
+    // pass through until the delay line is filled
+    uint16_t delayed = in;
+    if (count < delay) {
+      count++;
+    } else {
+      delayed = history[wr_index];
+    }
+    history[wr_index] = in;
+    wr_index = (wr_index + 1 < delay) ? (wr_index + 1) : 0;
+    *out = ((uint32_t)in + delayed) / 2;
+    return true;
+  }
+
+  inline size_t process(const uint16_t *in, size_t n, uint16_t *out) {
+    return filter_block(*this, in, n, out);
+  }
+};
+
+static constexpr uint32_t cic_gain(uint16_t rate, uint8_t order) {
+  return order == 0 ? 1 : rate * cic_gain(rate, order - 1);
+}
+
+static constexpr uint8_t cic_gain_bits(uint32_t gain) {
+  return gain <= 1 ? 0 : 1 + cic_gain_bits((gain + 1) / 2);
+}
+
+// CIC decimator with ORDER stages, decimates by RATE with unity DC gain.
+// Lets the ADC run at a much higher rate than the CDR.
+template <uint16_t RATE, uint8_t ORDER = 3>
+class CicDecimator {
+ private:
+  static_assert(RATE >= 1, "RATE must be 1 or more.");
+  static_assert(ORDER >= 1, "ORDER must be 1 or more.");
+  static constexpr uint32_t GAIN = cic_gain(RATE, ORDER);
+  static_assert(ADC_BITS + cic_gain_bits(GAIN) <= 32,
+                "RATE and ORDER too large for 32 bit accumulators.");
+
+  // wrap-around arithmetic is intended
+  uint32_t integ[ORDER];
+  uint32_t comb[ORDER];
+  uint16_t phase;
+
+ public:
+  inline CicDecimator() { init(); }
+
+  inline void init() {
+    for (uint8_t i = 0; i < ORDER; i++) {
+      integ[i] = 0;
+      comb[i] = 0;
+    }
+    phase = 0;
+  }
+
+  inline bool update(uint16_t in, uint16_t *out) {
+    integ[0] += in;
+    for (uint8_t i = 1; i < ORDER; i++) {
+      integ[i] += integ[i - 1];
+    }
+    if (++phase < RATE) return false;
+    phase = 0;
+
+    uint32_t y = integ[ORDER - 1];
+    for (uint8_t i = 0; i < ORDER; i++) {
+      const uint32_t x = y;
+      y -= comb[i];
+      comb[i] = x;
+    }
+    *out = y / GAIN;
+    return true;
+  }
+
+  inline size_t process(const uint16_t *in, size_t n, uint16_t *out) {
+    return filter_block(*this, in, n, out);
+  }
+};
+
+// Cascade of filters. Blocks are processed stage by stage in place, e.g.:
+//   FilterChain<CicDecimator<16>, MedianFilter<3>> filter;
+//   n = filter.process(adc_buff, n, adc_buff);
+//   receiver.update_block(adc_buff, n, &rx_state);
+// The stages are accessible as `filter.first`, `filter.rest.first`, ...
+template <class... Stages>
+class FilterChain;
+
+template <>
+class FilterChain<> {
+ public:
+  inline void init() {}
+
+  inline bool update(uint16_t in, uint16_t *out) {
+    *out = in;
+    return true;
+  }
+
+  inline size_t process(const uint16_t *in, size_t n, uint16_t *out) {
+    if (in != out) {
+      for (size_t i = 0; i < n; i++) out[i] = in[i];
+    }
+    return n;
+  }
+};
+
+template <class First, class... Rest>
+class FilterChain<First, Rest...> {
+ public:
+  First first;
+  FilterChain<Rest...> rest;
+
+  inline void init() {
+    first.init();
+    rest.init();
+  }
+
+  inline bool update(uint16_t in, uint16_t *out) {
+    uint16_t tmp;
+    return first.update(in, &tmp) && rest.update(tmp, out);
+  }
+
+  inline size_t process(const uint16_t *in, size_t n, uint16_t *out) {
+    n = first.process(in, n, out);
+    return rest.process(out, n, out);
+  }
+};
+
+}  // namespace vlcfg
+
+#endif
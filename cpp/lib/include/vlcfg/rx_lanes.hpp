@@ -0,0 +1,194 @@
+#ifndef VLCFG_RX_LANES_HPP
+#define VLCFG_RX_LANES_HPP
+
+#include "vlcfg/common.hpp"
+#include "vlcfg/rx_decoder.hpp"
+
+namespace vlcfg {
+
+static constexpr uint8_t MAX_LANES = 4;
+// bytes buffered per lane to absorb the skew between the lanes
+static constexpr uint8_t MAX_LANE_SKEW = 8;
+
+// Reassembles a frame striped across several lanes.
+//
+// Each lane is a frame of its own: `CTRL` `SOF` (or `SOF_FEC`), a lane header
+// byte, (lane << 4) | number of lanes, every N-th byte of the frame body
+// starting from byte `lane`, then `CTRL` `EOF`. The lane header maps the
+// inputs to the lanes, so the sensors can be wired in any order. Single lane
+// frames have no lane header.
+//
+// The lanes lock and start at slightly different times, so the bytes are
+// queued per lane and passed to the decoder in the original order as soon as
+// the next one is available.
+class RxLaneMerger {
+ private:
+  struct Lane {
+    PcsOutput queue[MAX_LANE_SKEW];
+    uint8_t rd_index;
+    uint8_t count;
+  };
+
+  uint8_t num_lanes = 1;
+  // lane of each input, or -1 before the lane header
+  int8_t lane_of[MAX_LANES];
+  bool in_frame[MAX_LANES];
+  bool ended[MAX_LANES];
+  Lane lanes[MAX_LANES];
+  int16_t sof;
+  uint8_t next_lane;
+  uint8_t num_ended;
+  RxState state;
+
+ public:
+  inline RxLaneMerger() { init(1); }
+  void init(uint8_t num_lanes);
+  inline uint8_t get_num_lanes() const { return num_lanes; }
+  Result update(uint8_t input, const PcsOutput *in, RxDecoder &decoder,
+                RxState *rx_state);
+  // ERROR on a merging error, the decoder state otherwise
+  inline RxState get_state(const RxDecoder &decoder) const {
+    return state == RxState::ERROR ? state : decoder.get_state();
+  }
+
+ private:
+  Result receive(uint8_t input, const PcsOutput *in);
+  Result drain(RxDecoder &decoder, RxState *rx_state);
+};
+
+#ifdef VLCFG_IMPLEMENTATION
+
+void RxLaneMerger::init(uint8_t num_lanes) {
+  if (num_lanes < 1) num_lanes = 1;
+  if (num_lanes > MAX_LANES) num_lanes = MAX_LANES;
+  this->num_lanes = num_lanes;
+  for (uint8_t i = 0; i < MAX_LANES; i++) {
+    lane_of[i] = -1;
+    in_frame[i] = false;
+    ended[i] = false;
+    lanes[i].rd_index = 0;
+    lanes[i].count = 0;
+  }
+  sof = SYMBOL_NONE;
+  next_lane = 0;
+  num_ended = 0;
+  state = RxState::IDLE;
+}
+
+// Takes the PCS output of `input` and passes the bytes that are in order to
+// the decoder.
+Result RxLaneMerger::update(uint8_t input, const PcsOutput *in,
+                            RxDecoder &decoder, RxState *rx_state) {
+  if (input >= num_lanes || in == nullptr) {
+    VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+  }
+
+  Result ret = Result::SUCCESS;
+  if (state == RxState::IDLE || state == RxState::RECEIVING) {
+    ret = receive(input, in);
+    if (ret == Result::SUCCESS) ret = drain(decoder, rx_state);
+    if (ret != Result::SUCCESS) state = RxState::ERROR;
+  }
+  if (rx_state) *rx_state = get_state(decoder);
+  return ret;
+}
+
+Result RxLaneMerger::receive(uint8_t input, const PcsOutput *in) {
+  if (!in_frame[input]) {
+    if (in->rxed &&
+        (in->rx_byte == SYMBOL_SOF || in->rx_byte == SYMBOL_SOF_FEC)) {
+      if (sof != SYMBOL_NONE && sof != in->rx_byte) {
+        VLCFG_THROW(Result::ERR_BAD_LANE_HEADER);
+      }
+      sof = in->rx_byte;
+      in_frame[input] = true;
+      if (num_lanes == 1) lane_of[input] = 0;
+    }
+    return Result::SUCCESS;
+  }
+  if (ended[input]) return Result::SUCCESS;
+
+  if (in->state == PcsState::LOS) {
+    VLCFG_THROW(Result::ERR_LOS);
+  }
+  if (!in->rxed) return Result::SUCCESS;
+
+  if (in->rx_byte == SYMBOL_EOF) {
+    ended[input] = true;
+    num_ended++;
+    return Result::SUCCESS;
+  }
+  if (in->rx_byte < 0) {
+    VLCFG_THROW(Result::ERR_EOF_EXPECTED);
+  }
+
+  if (lane_of[input] < 0) {
+    const uint8_t lane = in->rx_byte >> 4;
+    if ((in->rx_byte & 0xf) != num_lanes || lane >= num_lanes) {
+      VLCFG_THROW(Result::ERR_BAD_LANE_HEADER);
+    }
+    for (uint8_t i = 0; i < num_lanes; i++) {
+      if (lane_of[i] == lane) VLCFG_THROW(Result::ERR_BAD_LANE_HEADER);
+    }
+    lane_of[input] = lane;
+    VLCFG_PRINTF("input %d is lane %d\n", (int)input, (int)lane);
+    return Result::SUCCESS;
+  }
+
+  Lane &lane = lanes[lane_of[input]];
+  if (lane.count >= MAX_LANE_SKEW) {
+    VLCFG_THROW(Result::ERR_OVERFLOW);
+  }
+  uint8_t wr_index = lane.rd_index + lane.count;
+  if (wr_index >= MAX_LANE_SKEW) wr_index -= MAX_LANE_SKEW;
+  lane.queue[wr_index] = *in;
+  lane.count++;
+  return Result::SUCCESS;
+}
+
+Result RxLaneMerger::drain(RxDecoder &decoder, RxState *rx_state) {
+  if (sof == SYMBOL_NONE) return Result::SUCCESS;
+
+  if (state == RxState::IDLE) {
+    PcsOutput out;
+    out.state = PcsState::RXED_SOF;
+    out.rxed = true;
+    out.rx_byte = sof;
+    VLCFG_TRY(decoder.update(&out, rx_state));
+    state = RxState::RECEIVING;
+  }
+
+  while (true) {
+    Lane &lane = lanes[next_lane];
+    if (lane.count == 0) break;
+    VLCFG_TRY(decoder.update(&lane.queue[lane.rd_index], rx_state));
+    if (++lane.rd_index >= MAX_LANE_SKEW) lane.rd_index = 0;
+    lane.count--;
+    if (++next_lane >= num_lanes) next_lane = 0;
+  }
+
+  // the frame ends when all lanes are ended and drained, the lanes after
+  // the last byte have nothing left
+  if (num_ended < num_lanes) return Result::SUCCESS;
+  for (uint8_t i = 0; i < num_lanes; i++) {
+    if (lanes[i].count > 0) VLCFG_THROW(Result::ERR_EXTRA_BYTES);
+  }
+  PcsOutput out;
+  out.state = PcsState::RXED_EOF;
+  out.rxed = true;
+  out.rx_byte = SYMBOL_EOF;
+  VLCFG_TRY(decoder.update(&out, rx_state));
+  if (decoder.get_state() == RxState::IDLE) {
+    // a segment of a larger payload, hunts for the next frame
+    init(num_lanes);
+    return Result::SUCCESS;
+  }
+  state = RxState::COMPLETED;
+  return Result::SUCCESS;
+}
+
+#endif
+
+}  // namespace vlcfg
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef VLCFG_RX_PACKED_HPP
+#define VLCFG_RX_PACKED_HPP
+
+#include "vlcfg/common.hpp"
+#include "vlcfg/rx_cdr.hpp"
+
+namespace vlcfg {
+
+// maximum number of bits recovered from a word
+static constexpr uint8_t PACKED_MAX_BITS = 32 / MIN_SAMPLES_PER_BIT + 1;
+// maximum half width of the majority vote window in samples
+static constexpr uint8_t PACKED_MAX_HALF_WINDOW = 7;
+
+struct PackedCdrOutput {
+  bool signal_detected;
+  uint8_t num_bits;
+  // recovered bits, the oldest one in the LSB
+  uint16_t rx_bits;
+  uint8_t rx_conf[PACKED_MAX_BITS];
+};
+
+// Clock data recovery for 1-bit digital input (comparator, GPIO) packed into
+// 32 bit words, the oldest sample in the LSB (e.g. RP2040 PIO with right
+// shift, or SPI in LSB first). Edges are located with bit scans and each bit
+// is decided by the majority of the central half of the bit with popcount,
+// so the cost is per edge and per bit instead of per sample.
+class RxPackedCdr {
+ private:
+  RateConfig rate = default_rate_config();
+  bool deglitch = false;
+  uint32_t last_raw;
+  uint32_t last_word;
+  // bit positions in samples (8 bit fixed point) relative to the first
+  // sample of the current word
+  int32_t bit_pos;
+  int32_t last_edge_pos;
+  uint16_t idle_samples;
+  uint8_t edge_count;
+  bool has_phase;
+  bool sig_det;
+
+ public:
+  inline RxPackedCdr() { init(); }
+  void init();
+  Result set_rate(const RateConfig &rate);
+  inline const RateConfig &get_rate() const { return rate; }
+  // Removes single-sample glitches with a 3-tap majority vote.
+  inline void set_deglitch(bool enable) { deglitch = enable; }
+  inline bool get_deglitch() const { return deglitch; }
+  Result update(uint32_t word, PackedCdrOutput *out);
+  inline bool signal_detected() const { return sig_det; }
+
+ private:
+  void on_edge(int32_t pos);
+};
+
+#ifdef VLCFG_IMPLEMENTATION
+
+void RxPackedCdr::init() {
+  last_raw = 0;
+  last_word = 0;
+  bit_pos = 0;
+  last_edge_pos = 0;
+  idle_samples = 0;
+  edge_count = 0;
+  has_phase = false;
+  sig_det = false;
+  VLCFG_PRINTF("RX packed CDR initialized.\n");
+}
+
+Result RxPackedCdr::set_rate(const RateConfig &rate) {
+  if (rate.baudrate == 0) {
+    VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+  }
+  if (rate.samples_per_bit < MIN_SAMPLES_PER_BIT ||
+      MAX_SAMPLES_PER_BIT < rate.samples_per_bit) {
+    VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+  }
+  this->rate = rate;
+  init();
+  return Result::SUCCESS;
+}
+
+Result RxPackedCdr::update(uint32_t word, PackedCdrOutput *out) {
+  if (out == nullptr) {
+    VLCFG_THROW(Result::ERR_NULL_POINTER);
+  }
+
+  // majority of the sample and the two preceding ones, delays by one sample
+  if (deglitch) {
+    const uint32_t a = (word << 1) | (last_raw >> 31);
+    const uint32_t b = (word << 2) | (last_raw >> 30);
+    last_raw = word;
+    word = (word & a) | (word & b) | (a & b);
+  }
+
+  const int32_t period = (int32_t)rate.samples_per_bit << 8;
+  uint8_t half_window = rate.samples_per_bit / 4;
+  if (half_window > PACKED_MAX_HALF_WINDOW) {
+    half_window = PACKED_MAX_HALF_WINDOW;
+  }
+  const uint8_t window = half_window * 2 + 1;
+  const uint64_t history = ((uint64_t)word << 32) | last_word;
+
+  // bit i is set if sample i differs from the previous one
+  const uint32_t word_edges = word ^ ((word << 1) | (last_word >> 31));
+  uint32_t edges = word_edges;
+
+  out->num_bits = 0;
+  out->rx_bits = 0;
+  while (true) {
+    // the edge is between the previous and current sample
+    const int32_t edge_pos =
+        edges ? ((int32_t)ctz32(edges) << 8) - 0x80 : INT32_MAX;
+
+    // decide the bit when its window is in the history and no edge precedes
+    // its center
+    const int32_t center = (bit_pos + 0x80) >> 8;
+    if (has_phase && bit_pos <= edge_pos && center + half_window < 32) {
+      int8_t start = center - half_window;
+      if (start < -32) start = -32;
+      const uint32_t bits = (uint32_t)(history >> (start + 32)) &
+                            ((1ul << window) - 1);
+      const uint8_t ones = popcount32(bits);
+      const bool rx_bit = ones * 2 > window;
+      if (sig_det && out->num_bits < PACKED_MAX_BITS) {
+        const uint8_t agree = rx_bit ? ones : (window - ones);
+        if (rx_bit) out->rx_bits |= 1 << out->num_bits;
+        out->rx_conf[out->num_bits++] =
+            (uint32_t)(agree * 2 - window) * 255 / window;
+      }
+      bit_pos += period;
+      continue;
+    }
+
+    if (!edges) break;
+    edges &= edges - 1;
+    on_edge(edge_pos);
+  }
+
+  // loss of signal when the line stays idle for 10 bits
+  uint32_t idle = word_edges ? clz32(word_edges) : (idle_samples + 32);
+  const uint32_t idle_limit = (uint32_t)rate.samples_per_bit * SYMBOL_BITS * 2;
+  if (idle > idle_limit) {
+    idle = idle_limit;
+    if (sig_det) VLCFG_PRINTF("RX packed CDR lost signal.\n");
+    has_phase = false;
+    edge_count = 0;
+    sig_det = false;
+  }
+  idle_samples = idle;
+
+  // rebase the positions to the next word, bit_pos is set again by on_edge()
+  // when the phase is lost, and would overflow while the line is idle
+  last_word = word;
+  if (has_phase) bit_pos -= 32 << 8;
+  last_edge_pos -= 32 << 8;
+  if (last_edge_pos < -period) last_edge_pos = -period;
+
+  out->signal_detected = sig_det;
+  return Result::SUCCESS;
+}
+
+// Aligns the bit boundaries to the edge at `pos`.
+void RxPackedCdr::on_edge(int32_t pos) {
+  const int32_t period = (int32_t)rate.samples_per_bit << 8;
+
+  // edges closer than half a bit are glitches, and are not counted for the
+  // signal detection
+  if (pos - last_edge_pos >= period / 2 && edge_count < PLL_ACQ_EDGES) {
+    edge_count++;
+    if (!sig_det && edge_count >= FAST_LOCK_EDGES) {
+      sig_det = true;
+      VLCFG_PRINTF("RX packed CDR detected signal.\n");
+    }
+  }
+  last_edge_pos = pos;
+
+  if (!has_phase) {
+    has_phase = true;
+    bit_pos = pos + period / 2;
+    return;
+  }
+
+  // phase error from the nearest bit boundary
+  int32_t err = pos - (bit_pos - period / 2);
+  if (err >= period / 2) {
+    err -= period;
+  } else if (err < -period / 2) {
+    err += period;
+  }
+  const uint8_t kp =
+      (edge_count < PLL_ACQ_EDGES) ? PLL_ACQ_KP_SHIFT : PLL_KP_SHIFT;
+  bit_pos += err >> kp;
+}
+
+#endif
+
+}  // namespace vlcfg
+
+#endif
@@ -2,72 +2,122 @@
 #define VLCFG_RX_PCS_HPP
 
 #include "vlcfg/common.hpp"
+#include "vlcfg/line_code.hpp"
 
 namespace vlcfg {
 
-class RxPcs {
+// soft decision: number of successive corrected bytes regarded as LOS
+static constexpr uint8_t PCS_MAX_CORRECTED_BYTES = 2;
+// longest codeword of the line codes
+static constexpr uint8_t MAX_CODE_BITS = 16;
+// dual-rate frames: header bytes after CTRL RATE, SYNC codewords sent at the
+// payload rate before SOF, and the highest rate multiplier
+static constexpr uint8_t RATE_HEADER_LEN = 4;
+static constexpr uint8_t RATE_PREAMBLE = 4;
+static constexpr uint8_t MAX_RATE_MUL = 8;
+
+#if VLCFG_PCS_LUT
+template <class LINE_CODE>
+struct CodewordLut {
+  int16_t table[1 << LINE_CODE::CODE_BITS];
+  constexpr CodewordLut() : table() {
+    for (uint16_t i = 0; i < (1 << LINE_CODE::CODE_BITS); i++) {
+      table[i] = SYMBOL_INVALID;
+    }
+    for (uint16_t i = 0; i < 256; i++) {
+      table[LINE_CODE::encode(i)] = i;
+    }
+    table[LINE_CODE::SYNC_WORD] = SYMBOL_SYNC;
+    table[LINE_CODE::SOF_WORD] = SYMBOL_SOF;
+    table[LINE_CODE::SOF_FEC_WORD] = SYMBOL_SOF_FEC;
+    table[LINE_CODE::EOF_WORD] = SYMBOL_EOF;
+    table[LINE_CODE::PAM4_WORD] = SYMBOL_PAM4;
+    table[LINE_CODE::RATE_WORD] = SYMBOL_RATE;
+  }
+};
+
+template <class LINE_CODE>
+static constexpr CodewordLut<LINE_CODE> CODEWORD_LUT;
+#endif
+
+// Decodes a codeword to a byte, SYMBOL_SYNC, SYMBOL_SOF, SYMBOL_SOF_FEC,
+// SYMBOL_EOF, SYMBOL_PAM4, SYMBOL_RATE or SYMBOL_INVALID.
+template <class LINE_CODE>
+static inline int16_t lookup_codeword(uint16_t codeword) {
+#if VLCFG_PCS_LUT
+  return CODEWORD_LUT<LINE_CODE>.table[codeword];
+#else
+  return LINE_CODE::decode(codeword);
+#endif
+}
+
+// LINE_CODE selects the line code, see line_code.hpp. The transmitter has to
+// use the same one.
+template <class LINE_CODE = LineCode4b5b>
+class RxPcsT {
+  static_assert(LINE_CODE::CODE_BITS <= MAX_CODE_BITS,
+                "CODE_BITS must be MAX_CODE_BITS or less.");
+
+ public:
+  static constexpr uint8_t CODE_BITS = LINE_CODE::CODE_BITS;
+
  private:
+  static constexpr uint16_t CODEWORD_MASK = (1 << CODE_BITS) - 1;
+
   PcsState state;
   uint16_t shift_reg;
   uint8_t phase;
+  bool soft_decision = false;
+  // invalid symbols in FEC frames are decoded like the soft decision, and
+  // left to the Reed-Solomon decoder
+  bool fec_frame;
+  // rx_conf of each bit in shift_reg, [0] is the latest
+  uint8_t conf_reg[CODE_BITS];
+  uint8_t num_corrected;
+  uint8_t rate_header[RATE_HEADER_LEN];
+  uint8_t rate_header_len;
+  uint8_t rate_mul;
+  uint32_t rate_bits;
 
  public:
 #ifdef VLCFG_DEBUG
   int8_t dbg_rxed_symbol;
 #endif
 
-  inline RxPcs() { init(); }
+  inline RxPcsT() { init(); }
   void init();
   Result update(const CdrOutput *in, PcsOutput *out);
+  Result update_bits(uint32_t bits, uint8_t num_bits, const uint8_t *conf,
+                     PcsOutput *out, uint8_t *consumed);
   inline PcsState get_state() const { return state; }
+  // Decodes invalid symbols to the nearest data symbol weighted by the bit
+  // confidences instead of losing the symbol lock, and reports the second
+  // most likely byte for the Chase decoding.
+  inline void set_soft_decision(bool enable) { soft_decision = enable; }
+  inline bool get_soft_decision() const { return soft_decision; }
+  // Payload rate multiplier of the last dual-rate header, and the number of
+  // bits at that rate up to the end of the frame (with some slack).
+  inline uint8_t get_rate_mul() const { return rate_mul; }
+  inline uint32_t get_rate_bits() const { return rate_bits; }
 
  private:
   void reset_internal();
+  void shift_in(uint32_t rev_bits, uint8_t n, const uint8_t *conf);
+  bool decode_codeword(int16_t code, PcsOutput *out);
+  bool decode_soft(PcsOutput *out);
+  bool parse_rate_header();
 };
 
-#ifdef VLCFG_IMPLEMENTATION
-
-static const int8_t DECODE_TABLE[1 << SYMBOL_BITS] = {
-    SYMBOL_INVALID,  // 0b00000
-    SYMBOL_INVALID,  // 0b00001
-    SYMBOL_INVALID,  // 0b00010
-    SYMBOL_SOF,      // 0b00011
-    SYMBOL_INVALID,  // 0b00100
-    0x0,             // 0b00101
-    0x1,             // 0b00110
-    SYMBOL_EOF,      // 0b00111
-    SYMBOL_INVALID,  // 0b01000
-    0x2,             // 0b01001
-    SYMBOL_CTRL,     // 0b01010
-    0x3,             // 0b01011
-    0x4,             // 0b01100
-    0x5,             // 0b01101
-    0x6,             // 0b01110
-    SYMBOL_INVALID,  // 0b01111
-    SYMBOL_INVALID,  // 0b10000
-    SYMBOL_SYNC,     // 0b10001
-    0x7,             // 0b10010
-    0x8,             // 0b10011
-    0x9,             // 0b10100
-    0xA,             // 0b10101
-    0xB,             // 0b10110
-    SYMBOL_INVALID,  // 0b10111
-    0xC,             // 0b11000
-    0xD,             // 0b11001
-    0xE,             // 0b11010
-    SYMBOL_INVALID,  // 0b11011
-    0xF,             // 0b11100
-    SYMBOL_INVALID,  // 0b11101
-    SYMBOL_INVALID,  // 0b11110
-    SYMBOL_INVALID,  // 0b11111
-};
+using RxPcs = RxPcsT<>;
 
-void RxPcs::init() {
+template <class LINE_CODE>
+void RxPcsT<LINE_CODE>::init() {
   reset_internal();
   VLCFG_PRINTF("RX PCS initialized.\n");
 }
 
-Result RxPcs::update(const CdrOutput *in, PcsOutput *out) {
+template <class LINE_CODE>
+Result RxPcsT<LINE_CODE>::update(const CdrOutput *in, PcsOutput *out) {
 #ifdef VLCFG_DEBUG
   dbg_rxed_symbol = SYMBOL_NONE;
 #endif
@@ -88,91 +138,99 @@ Result RxPcs::update(const CdrOutput *in, PcsOutput *out) {
   }
 
   // shift register
-  constexpr uint16_t SHIFT_REG_MASK = (1 << (SYMBOL_BITS * 2)) - 1;
-  shift_reg = (shift_reg << 1) & SHIFT_REG_MASK;
-  if (in->rx_bit) shift_reg |= 1;
-
-  constexpr uint8_t SYMBOL_MASK = (1 << SYMBOL_BITS) - 1;
-  int8_t nibble_h = DECODE_TABLE[(shift_reg >> SYMBOL_BITS) & SYMBOL_MASK];
-  int8_t nibble_l = DECODE_TABLE[shift_reg & SYMBOL_MASK];
-  bool rxed_sync = false, rxed_sof = false, rxed_eof = false;
-  if (nibble_h == SYMBOL_CTRL) {
-    rxed_sync = (nibble_l == SYMBOL_SYNC);
-    rxed_sof = (nibble_l == SYMBOL_SOF);
-    rxed_eof = (nibble_l == SYMBOL_EOF);
+  shift_reg = ((shift_reg << 1) | in->rx_bit) & CODEWORD_MASK;
+  for (uint8_t i = CODE_BITS - 1; i > 0; i--) {
+    conf_reg[i] = conf_reg[i - 1];
   }
+  conf_reg[0] = in->rx_conf;
 
 #ifdef VLCFG_DEBUG
-  if ((state == PcsState::LOS) || (phase == SYMBOL_BITS - 1) || (phase == SYMBOL_BITS * 2 - 1)) {
-    dbg_rxed_symbol = nibble_l;
-  }
+  dbg_rxed_symbol = LINE_CODE::debug_symbol(
+      shift_reg, (state == PcsState::LOS) ? (CODE_BITS - 1) : phase);
 #endif
 
   bool rxed = false;
   PcsState last_state = state;
   if (state == PcsState::LOS) {
-    if (rxed_sync) {
+    if (shift_reg == LINE_CODE::SYNC_WORD) {
       // symbol lock
       phase = 0;
       state = PcsState::RXED_SYNC1;
-    } else {
-      state = PcsState::LOS;
     }
-  } else if (phase < (SYMBOL_BITS * 2 - 1)) {
+  } else if (phase < (CODE_BITS - 1)) {
     phase++;
   } else {
     phase = 0;
+    rxed = decode_codeword(lookup_codeword<LINE_CODE>(shift_reg), out);
+  }
 
-    // symbol decode
-    switch (state) {
-      case PcsState::RXED_SYNC1:
-        if (rxed_sync) {
-          state = PcsState::RXED_SYNC2;
-        } else {
-          state = PcsState::LOS;
-        }
-        break;
+#ifdef VLCFG_DEBUG
+  if (last_state != state) {
+    VLCFG_PRINTF("PCS State: %d --> %d\n", (int)last_state, (int)state);
+  }
+#endif
 
-      case PcsState::RXED_SYNC2:
-        if (rxed_sof) {
-          rxed = true;
-          out->rx_byte = SYMBOL_SOF;
-          state = PcsState::RXED_SOF;
-        } else if (rxed_sync) {
-          state = PcsState::RXED_SYNC2;
-        } else {
-          state = PcsState::LOS;
-        }
-        break;
+  out->state = state;
+  out->rxed = rxed;
+  return Result::SUCCESS;
+}
 
-      case PcsState::RXED_SOF:
-      case PcsState::RXED_BYTE:
-        if (rxed_eof) {
-          rxed = true;
-          out->rx_byte = SYMBOL_EOF;
-          state = PcsState::RXED_EOF;
-        } else if (nibble_h >= 0 && nibble_l >= 0) {
-          rxed = true;
-          out->rx_byte = (nibble_h << 4) | nibble_l;
-          state = PcsState::RXED_BYTE;
-        } else {
-          state = PcsState::LOS;
-        }
-        break;
+// Processes up to `num_bits` bits of `bits`, the oldest one in the LSB. Stops
+// after a codeword is decoded or the symbol lock is acquired, so that the
+// caller can pass the output to the decoder. `conf` holds the rx_conf of each
+// bit, or nullptr to regard all bits as reliable.
+template <class LINE_CODE>
+Result RxPcsT<LINE_CODE>::update_bits(uint32_t bits, uint8_t num_bits,
+                                      const uint8_t *conf, PcsOutput *out,
+                                      uint8_t *consumed) {
+#ifdef VLCFG_DEBUG
+  dbg_rxed_symbol = SYMBOL_NONE;
+#endif
 
-      case PcsState::RXED_EOF:
-        if (rxed_sof) {
-          rxed = true;
-          out->rx_byte = SYMBOL_SOF;
-          state = PcsState::RXED_SOF;
-        } else if (rxed_sync) {
-          state = PcsState::RXED_SYNC2;
-        } else {
-          state = PcsState::LOS;
-        }
-        break;
+  if (out == nullptr || consumed == nullptr) {
+    VLCFG_THROW(Result::ERR_NULL_POINTER);
+  }
+  if (num_bits > 32) {
+    VLCFG_THROW(Result::ERR_VALUE_OUT_OF_RANGE);
+  }
 
-      default: break;
+  out->state = state;
+  out->rxed = false;
+  *consumed = num_bits;
+  if (num_bits == 0) return Result::SUCCESS;
+
+  // oldest bit in the MSB, same order as shift_reg
+  const uint32_t rev = reverse32(bits);
+#ifdef VLCFG_DEBUG
+  PcsState last_state = state;
+#endif
+
+  if (state == PcsState::LOS) {
+    // Bit q of `match` is set if the codeword in bits q+CODE_BITS-1..q of the
+    // stream is SYNC. Bit 31 is the codeword ending with the oldest new bit.
+    const uint64_t stream = ((uint64_t)shift_reg << 32) | rev;
+    uint32_t match = 0xffffffff;
+    for (uint8_t k = 0; k < CODE_BITS; k++) {
+      const uint32_t x = stream >> k;
+      match &= ((LINE_CODE::SYNC_WORD >> k) & 1) ? x : ~x;
+    }
+    if (num_bits < 32) match &= ~(0xffffffff >> num_bits);
+    if (match != 0) *consumed = clz32(match) + 1;
+    shift_in(rev, *consumed, conf);
+    if (match != 0) {
+      phase = 0;
+      state = PcsState::RXED_SYNC1;
+    }
+  } else {
+    const uint8_t need = CODE_BITS - phase;
+    if (num_bits < need) {
+      shift_in(rev, num_bits, conf);
+      phase += num_bits;
+    } else {
+      *consumed = need;
+      shift_in(rev, need, conf);
+      phase = 0;
+      out->rxed = decode_codeword(lookup_codeword<LINE_CODE>(shift_reg), out);
     }
   }
 
@@ -183,21 +241,201 @@ Result RxPcs::update(const CdrOutput *in, PcsOutput *out) {
 #endif
 
   out->state = state;
-  out->rxed = rxed;
   return Result::SUCCESS;
 }
 
-void RxPcs::reset_internal() {
+// Shifts the first `n` bits of `rev_bits` (the oldest one in the MSB) into
+// shift_reg.
+template <class LINE_CODE>
+void RxPcsT<LINE_CODE>::shift_in(uint32_t rev_bits, uint8_t n,
+                                 const uint8_t *conf) {
+  const uint32_t chunk = rev_bits >> (32 - n);
+  if (n >= CODE_BITS) {
+    shift_reg = chunk & CODEWORD_MASK;
+  } else {
+    shift_reg = ((shift_reg << n) | chunk) & CODEWORD_MASK;
+  }
+
+  // the confidences are only used by the soft decision
+  if (!soft_decision && !fec_frame) return;
+  uint8_t i = (n > CODE_BITS) ? (n - CODE_BITS) : 0;
+  for (; i < n; i++) {
+    for (uint8_t j = CODE_BITS - 1; j > 0; j--) {
+      conf_reg[j] = conf_reg[j - 1];
+    }
+    conf_reg[0] = conf ? conf[i] : 0xff;
+  }
+}
+
+// Symbol decode on a codeword boundary. Returns true if `out` has a byte or a
+// frame delimiter.
+template <class LINE_CODE>
+bool RxPcsT<LINE_CODE>::decode_codeword(int16_t code, PcsOutput *out) {
+  const bool rxed_sync = (code == SYMBOL_SYNC);
+  const bool rxed_sof = (code == SYMBOL_SOF || code == SYMBOL_SOF_FEC);
+  const bool rxed_eof = (code == SYMBOL_EOF);
+  bool rxed = false;
+
+  switch (state) {
+    case PcsState::RXED_SYNC1:
+      if (rxed_sync) {
+        state = PcsState::RXED_SYNC2;
+      } else {
+        state = PcsState::LOS;
+      }
+      break;
+
+    case PcsState::RXED_SYNC2:
+      if (rxed_sof) {
+        rxed = true;
+        out->rx_byte = code;
+        fec_frame = (code == SYMBOL_SOF_FEC);
+        state = PcsState::RXED_SOF;
+      } else if (rxed_sync) {
+        state = PcsState::RXED_SYNC2;
+      } else if (code == SYMBOL_PAM4) {
+        // the receiver switches the CDR to PAM-4, the frame follows
+        rxed = true;
+        out->rx_byte = code;
+        state = PcsState::RXED_SYNC2;
+      } else if (code == SYMBOL_RATE) {
+        rate_header_len = 0;
+        state = PcsState::RXED_RATE;
+      } else {
+        state = PcsState::LOS;
+      }
+      break;
+
+    case PcsState::RXED_RATE:
+      if (code < 0) {
+        state = PcsState::LOS;
+        break;
+      }
+      rate_header[rate_header_len++] = code;
+      if (rate_header_len < RATE_HEADER_LEN) break;
+      if (parse_rate_header()) {
+        // the receiver switches the CDR to the payload rate, and the symbol
+        // lock is acquired again at that rate
+        rxed = true;
+        out->rx_byte = SYMBOL_RATE;
+      }
+      state = PcsState::LOS;
+      break;
+
+    case PcsState::RXED_SOF:
+    case PcsState::RXED_BYTE:
+      if (rxed_eof) {
+        rxed = true;
+        out->rx_byte = SYMBOL_EOF;
+        state = PcsState::RXED_EOF;
+      } else if (soft_decision || fec_frame) {
+        rxed = decode_soft(out);
+        if (!rxed) {
+          state = PcsState::LOS;
+        } else if (out->rx_byte == SYMBOL_EOF) {
+          state = PcsState::RXED_EOF;
+        } else {
+          state = PcsState::RXED_BYTE;
+        }
+      } else if (code >= 0) {
+        rxed = true;
+        out->rx_byte = code;
+        out->rx_alt = code;
+        out->rx_margin = 0xff;
+        state = PcsState::RXED_BYTE;
+      } else {
+        state = PcsState::LOS;
+      }
+      break;
+
+    case PcsState::RXED_EOF:
+      if (rxed_sof) {
+        rxed = true;
+        out->rx_byte = code;
+        fec_frame = (code == SYMBOL_SOF_FEC);
+        state = PcsState::RXED_SOF;
+      } else if (rxed_sync) {
+        state = PcsState::RXED_SYNC2;
+      } else {
+        state = PcsState::LOS;
+      }
+      break;
+
+    default: break;
+  }
+  return rxed;
+}
+
+// Header of the dual-rate frames: (CODE_ID << 4) | rate multiplier, the
+// number of bytes from SOF to EOF (exclusive, big endian), and the complement
+// of the XOR of the three bytes.
+template <class LINE_CODE>
+bool RxPcsT<LINE_CODE>::parse_rate_header() {
+  const uint8_t *h = rate_header;
+  const uint8_t mul = h[0] & 0xf;
+  const uint16_t len = ((uint16_t)h[1] << 8) | h[2];
+  if (h[3] != (uint8_t)~(h[0] ^ h[1] ^ h[2]) ||
+      (h[0] >> 4) != LINE_CODE::CODE_ID || mul < 2 || MAX_RATE_MUL < mul) {
+    VLCFG_PRINTF("Bad rate header: %02X %02X %02X %02X\n", (int)h[0],
+                 (int)h[1], (int)h[2], (int)h[3]);
+    return false;
+  }
+  rate_mul = mul;
+  // the preamble, SOF, the bytes and EOF, and two codewords of slack
+  rate_bits = (uint32_t)(RATE_PREAMBLE + len + 4) * CODE_BITS;
+  VLCFG_PRINTF("Rate header: x%d, %d bytes\n", (int)mul, (int)len);
+  return true;
+}
+
+// Maximum likelihood decoding of the codeword in shift_reg. Returns false if
+// too many bytes in a row needed a correction.
+template <class LINE_CODE>
+bool RxPcsT<LINE_CODE>::decode_soft(PcsOutput *out) {
+  uint16_t cost, margin;
+  uint8_t alt;
+  const uint8_t byte =
+      LINE_CODE::nearest(shift_reg, conf_reg, &cost, &alt, &margin);
+
+  const uint16_t eof_cost =
+      codeword_cost(shift_reg, LINE_CODE::EOF_WORD, CODE_BITS, conf_reg);
+  if (eof_cost < cost) {
+    cost = eof_cost;
+    out->rx_byte = SYMBOL_EOF;
+  } else {
+    out->rx_byte = byte;
+    out->rx_alt = alt;
+    out->rx_margin = margin < 0xff ? margin : 0xff;
+  }
+
+  if (cost == 0) {
+    num_corrected = 0;
+  } else if (++num_corrected > PCS_MAX_CORRECTED_BYTES) {
+    return false;
+  } else {
+    VLCFG_PRINTF("symbol corrected: 0x%03X --> 0x%02X\n", (int)shift_reg,
+                 (int)out->rx_byte);
+  }
+  return true;
+}
+
+template <class LINE_CODE>
+void RxPcsT<LINE_CODE>::reset_internal() {
   state = PcsState::LOS;
   phase = 0;
   shift_reg = 0;
+  num_corrected = 0;
+  fec_frame = false;
+  rate_header_len = 0;
+  rate_mul = 1;
+  rate_bits = 0;
+  for (uint8_t i = 0; i < CODE_BITS; i++) {
+    conf_reg[i] = 0;
+  }
 #ifdef VLCFG_DEBUG
   dbg_rxed_symbol = SYMBOL_NONE;
 #endif
 }
 
-#endif
-
 }  // namespace vlcfg
 
 #endif
@@ -0,0 +1,126 @@
+#ifndef VLCFG_RX_SEGMENT_HPP
+#define VLCFG_RX_SEGMENT_HPP
+
+#include "vlcfg/common.hpp"
+#include "vlcfg/rx_buff.hpp"
+
+namespace vlcfg {
+
+// first byte of a segment frame, the CBOR break code never starts an object
+static constexpr uint8_t SEGMENT_MARKER = 0xff;
+// marker, payload ID, segment index, segment count and payload length
+static constexpr uint8_t SEGMENT_HEADER_SIZE = 6;
+static constexpr uint16_t MAX_SEGMENTS = 255;
+
+// Reassembles a payload sent as a carousel of segment frames.
+//
+// The payload is the body of a regular frame, a CBOR object and its CRC32,
+// split into N segments of S bytes (the last one may be shorter), where S is
+// the payload length divided by N, rounded up. Each segment is sent in a
+// frame of its own, whose body is the segment header, the segment and the
+// CRC32 of both. The segments are stored to a buffer supplied by the caller
+// in any order, and a segment with another payload ID, count or length
+// starts over. The payload is complete when every segment has arrived.
+class RxSegments {
+ private:
+  uint8_t *buff = nullptr;
+  uint16_t capacity = 0;
+  uint8_t payload_id;
+  // 0 until the first segment arrives
+  uint8_t count = 0;
+  uint16_t length;
+  uint8_t num_received;
+  // bit i is set when segment i has been stored
+  uint8_t received[(MAX_SEGMENTS + 7) / 8];
+
+ public:
+  // Sets the buffer to assemble the payload in, nullptr disables the segment
+  // frames.
+  void set_buffer(uint8_t *buff, uint16_t capacity);
+  inline bool enabled() const { return buff != nullptr; }
+  // Discards the stored segments.
+  void init();
+  // Stores the segment frame in `rx`, whose CRC has been checked and removed.
+  Result store(RxBuff &rx, bool *completed);
+
+  inline const uint8_t *get_payload() const { return buff; }
+  inline uint16_t get_length() const { return count ? length : 0; }
+  inline uint8_t get_payload_id() const { return payload_id; }
+  inline uint8_t get_count() const { return count; }
+  inline uint8_t get_num_received() const { return num_received; }
+  inline bool is_received(uint8_t index) const {
+    return (received[index / 8] >> (index % 8)) & 1;
+  }
+};
+
+#ifdef VLCFG_IMPLEMENTATION
+
+void RxSegments::set_buffer(uint8_t *buff, uint16_t capacity) {
+  this->buff = buff;
+  this->capacity = buff ? capacity : 0;
+  init();
+}
+
+void RxSegments::init() {
+  count = 0;
+  length = 0;
+  num_received = 0;
+  for (uint8_t i = 0; i < sizeof(received); i++) {
+    received[i] = 0;
+  }
+}
+
+Result RxSegments::store(RxBuff &rx, bool *completed) {
+  *completed = false;
+  uint8_t marker, id, index, num;
+  uint16_t len;
+  VLCFG_TRY(rx.popU8(&marker));
+  VLCFG_TRY(rx.popU8(&id));
+  VLCFG_TRY(rx.popU8(&index));
+  VLCFG_TRY(rx.popU8(&num));
+  VLCFG_TRY(rx.popU16(&len));
+  if (marker != SEGMENT_MARKER || num == 0 || index >= num) {
+    VLCFG_THROW(Result::ERR_BAD_SEGMENT_HEADER);
+  }
+
+  const uint16_t seg_size = (len + num - 1) / num;
+  const uint32_t offset = (uint32_t)index * seg_size;
+  if (offset >= len) {
+    VLCFG_THROW(Result::ERR_BAD_SEGMENT_HEADER);
+  }
+  uint16_t seg_len = seg_size;
+  if (offset + seg_len > len) seg_len = len - offset;
+  if (rx.queued_size() != seg_len) {
+    VLCFG_THROW(Result::ERR_BAD_SEGMENT_HEADER);
+  }
+  if (len > capacity) {
+    VLCFG_THROW(Result::ERR_OVERFLOW);
+  }
+
+  if (count == 0 || id != payload_id || num != count || len != length) {
+    VLCFG_PRINTF("New segmented payload: id=%d, %d segments, %d bytes\n",
+                 (int)id, (int)num, (int)len);
+    init();
+    payload_id = id;
+    count = num;
+    length = len;
+  }
+
+  if (is_received(index)) {
+    VLCFG_PRINTF("Segment %d/%d already stored\n", (int)index, (int)count);
+    return Result::SUCCESS;
+  }
+  VLCFG_TRY(rx.popBytes(buff + offset, seg_len));
+  received[index / 8] |= 1 << (index % 8);
+  num_received++;
+  VLCFG_PRINTF("Segment %d/%d stored, %d received\n", (int)index, (int)count,
+               (int)num_received);
+  *completed = (num_received >= count);
+  return Result::SUCCESS;
+}
+
+#endif
+
+}  // namespace vlcfg
+
+#endif
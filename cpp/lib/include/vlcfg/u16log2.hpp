@@ -0,0 +1,258 @@
+#ifndef VLCFG_U16LOG2_HPP
+#define VLCFG_U16LOG2_HPP
+
+#include "vlcfg/common.hpp"
+
+// Full-range lookup table for ADC_BITS-wide inputs.
+// Needs C++14 constexpr to be generated at compile time, and is disabled on
+// AVR where const tables are placed in RAM.
+#ifndef VLCFG_U16LOG2_LUT
+#if (__cplusplus >= 201402L) && !defined(__AVR__)
+#define VLCFG_U16LOG2_LUT (1)
+#else
+#define VLCFG_U16LOG2_LUT (0)
+#endif
+#endif
+
+// SIMD kernel for u16log2_block(). Plain SSE2 has no byte shuffle for the
+// interpolation table lookup, so it is only used when the LUT is disabled.
+#if defined(__SSSE3__) || (defined(__SSE2__) && !VLCFG_U16LOG2_LUT)
+#define VLCFG_U16LOG2_SSE (1)
+#include <emmintrin.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define VLCFG_U16LOG2_NEON (1)
+#include <arm_neon.h>
+#endif
+
+namespace vlcfg {
+
+// Fixed point log2: upper 4 bits are the integer part, lower 12 bits are the
+// fractional part.
+uint16_t u16log2(uint16_t x);
+
+// Applies u16log2() to each element of `src`. `src` and `dst` may be the same.
+void u16log2_block(const uint16_t *src, uint16_t *dst, size_t n);
+
+#ifdef VLCFG_IMPLEMENTATION
+
+static constexpr uint16_t U16LOG2_TABLE[17] = {
+    0,   22,  44,  63,  82,  100, 118, 134, 150,
+    165, 179, 193, 207, 220, 232, 244, 256,
+};
+
+// U16LOG2_TABLE split into base and slope for the SIMD kernels:
+// (a * (256 - q) + b * q) == (a * 256 + (b - a) * q), and both fit in a byte.
+static const uint8_t U16LOG2_BASE[16] = {
+    0, 22, 44, 63, 82, 100, 118, 134, 150, 165, 179, 193, 207, 220, 232, 244,
+};
+static const uint8_t U16LOG2_SLOPE[16] = {
+    22, 22, 19, 19, 18, 18, 16, 16, 15, 14, 14, 14, 13, 12, 12, 12,
+};
+
+static VLCFG_CONSTEXPR14 uint16_t u16log2_interp(uint16_t x) {
+  if (x == 0) return 0;
+
+  uint16_t ret = 0xc000;
+  if (x & 0xf000) {
+    if (x & 0xc000) {
+      x >>= 2;
+      ret += 0x2000;
+    }
+    if (x & 0x2000) {
+      x >>= 1;
+      ret += 0x1000;
+    }
+  } else {
+    if (!(x & 0xffc0)) {
+      x <<= 6;
+      ret -= 0x6000;
+    }
+    if (!(x & 0xfe00)) {
+      x <<= 3;
+      ret -= 0x3000;
+    }
+    if (!(x & 0xf800)) {
+      x <<= 2;
+      ret -= 0x2000;
+    }
+    if (!(x & 0xf000)) {
+      x <<= 1;
+      ret -= 0x1000;
+    }
+  }
+
+  int index = (x >> 8) & 0xf;
+  uint16_t a = U16LOG2_TABLE[index];
+  uint16_t b = U16LOG2_TABLE[index + 1];
+  uint16_t q = x & 0xff;
+  uint16_t p = 256 - q;
+  ret += (a * p + b * q) >> 4;
+
+  return ret;
+}
+
+#if VLCFG_U16LOG2_LUT
+struct U16Log2Lut {
+  uint16_t table[1 << ADC_BITS];
+  constexpr U16Log2Lut() : table() {
+    for (uint32_t i = 0; i < (1 << ADC_BITS); i++) {
+      table[i] = u16log2_interp(i);
+    }
+  }
+};
+
+static constexpr U16Log2Lut U16LOG2_LUT;
+#endif
+
+uint16_t u16log2(uint16_t x) {
+#if VLCFG_U16LOG2_LUT
+  if (x < (1 << ADC_BITS)) return U16LOG2_LUT.table[x];
+#endif
+  return u16log2_interp(x);
+}
+
+#if defined(VLCFG_U16LOG2_SSE)
+
+// x = (x & test) ? (x >> shift) : x, ret += (x & test) ? inc : 0
+#define VLCFG_U16LOG2_SSE_SHR(test, shift, inc)                              \
+  do {                                                                       \
+    __m128i m = _mm_cmpeq_epi16(_mm_and_si128(x, _mm_set1_epi16(test)), z); \
+    x = _mm_or_si128(_mm_and_si128(m, x),                                    \
+                     _mm_andnot_si128(m, _mm_srli_epi16(x, shift)));         \
+    ret = _mm_add_epi16(ret, _mm_andnot_si128(m, _mm_set1_epi16(inc)));      \
+  } while (0)
+
+// x = (x & test) ? x : (x << shift), ret -= (x & test) ? 0 : dec
+#define VLCFG_U16LOG2_SSE_SHL(test, shift, dec)                              \
+  do {                                                                       \
+    __m128i m = _mm_cmpeq_epi16(_mm_and_si128(x, _mm_set1_epi16(test)), z); \
+    x = _mm_or_si128(_mm_andnot_si128(m, x),                                 \
+                     _mm_and_si128(m, _mm_slli_epi16(x, shift)));            \
+    ret = _mm_sub_epi16(ret, _mm_and_si128(m, _mm_set1_epi16(dec)));         \
+  } while (0)
+
+static inline __m128i u16log2_x8(__m128i x) {
+  const __m128i z = _mm_setzero_si128();
+  const __m128i zero_mask = _mm_cmpeq_epi16(x, z);
+  __m128i ret = _mm_set1_epi16((int16_t)0xc000);
+
+  // normalize to 0x1000..0x1fff, each step is a no-op for the other range
+  VLCFG_U16LOG2_SSE_SHR((int16_t)0xc000, 2, 0x2000);
+  VLCFG_U16LOG2_SSE_SHR(0x2000, 1, 0x1000);
+  VLCFG_U16LOG2_SSE_SHL((int16_t)0xffc0, 6, 0x6000);
+  VLCFG_U16LOG2_SSE_SHL((int16_t)0xfe00, 3, 0x3000);
+  VLCFG_U16LOG2_SSE_SHL((int16_t)0xf800, 2, 0x2000);
+  VLCFG_U16LOG2_SSE_SHL((int16_t)0xf000, 1, 0x1000);
+
+  const __m128i index =
+      _mm_and_si128(_mm_srli_epi16(x, 8), _mm_set1_epi16(0xf));
+  const __m128i q = _mm_and_si128(x, _mm_set1_epi16(0xff));
+
+#if defined(__SSSE3__)
+  // high byte of each lane selects 0x80, which makes pshufb output zero
+  const __m128i sel = _mm_or_si128(index, _mm_set1_epi16((int16_t)0x8000));
+  const __m128i base = _mm_shuffle_epi8(
+      _mm_loadu_si128((const __m128i *)U16LOG2_BASE), sel);
+  const __m128i slope = _mm_shuffle_epi8(
+      _mm_loadu_si128((const __m128i *)U16LOG2_SLOPE), sel);
+#else
+  __m128i base = z;
+  __m128i slope = z;
+  for (int i = 0; i < 16; i++) {
+    __m128i m = _mm_cmpeq_epi16(index, _mm_set1_epi16(i));
+    base =
+        _mm_or_si128(base, _mm_and_si128(m, _mm_set1_epi16(U16LOG2_BASE[i])));
+    slope = _mm_or_si128(slope,
+                         _mm_and_si128(m, _mm_set1_epi16(U16LOG2_SLOPE[i])));
+  }
+#endif
+
+  ret = _mm_add_epi16(ret, _mm_slli_epi16(base, 4));
+  ret = _mm_add_epi16(ret, _mm_srli_epi16(_mm_mullo_epi16(slope, q), 4));
+  return _mm_andnot_si128(zero_mask, ret);
+}
+
+#undef VLCFG_U16LOG2_SSE_SHR
+#undef VLCFG_U16LOG2_SSE_SHL
+
+void u16log2_block(const uint16_t *src, uint16_t *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), u16log2_x8(x));
+  }
+  for (; i < n; i++) {
+    dst[i] = u16log2(src[i]);
+  }
+}
+
+#elif defined(VLCFG_U16LOG2_NEON)
+
+static inline uint16x8_t u16log2_x8(uint16x8_t x) {
+  const uint16x8_t zero_mask = vceqq_u16(x, vdupq_n_u16(0));
+  uint16x8_t ret = vdupq_n_u16(0xc000);
+  uint16x8_t m;
+
+  // normalize to 0x1000..0x1fff, each step is a no-op for the other range
+  m = vtstq_u16(x, vdupq_n_u16(0xc000));
+  x = vbslq_u16(m, vshrq_n_u16(x, 2), x);
+  ret = vaddq_u16(ret, vandq_u16(m, vdupq_n_u16(0x2000)));
+  m = vtstq_u16(x, vdupq_n_u16(0x2000));
+  x = vbslq_u16(m, vshrq_n_u16(x, 1), x);
+  ret = vaddq_u16(ret, vandq_u16(m, vdupq_n_u16(0x1000)));
+  m = vtstq_u16(x, vdupq_n_u16(0xffc0));
+  x = vbslq_u16(m, x, vshlq_n_u16(x, 6));
+  ret = vsubq_u16(ret, vbicq_u16(vdupq_n_u16(0x6000), m));
+  m = vtstq_u16(x, vdupq_n_u16(0xfe00));
+  x = vbslq_u16(m, x, vshlq_n_u16(x, 3));
+  ret = vsubq_u16(ret, vbicq_u16(vdupq_n_u16(0x3000), m));
+  m = vtstq_u16(x, vdupq_n_u16(0xf800));
+  x = vbslq_u16(m, x, vshlq_n_u16(x, 2));
+  ret = vsubq_u16(ret, vbicq_u16(vdupq_n_u16(0x2000), m));
+  m = vtstq_u16(x, vdupq_n_u16(0xf000));
+  x = vbslq_u16(m, x, vshlq_n_u16(x, 1));
+  ret = vsubq_u16(ret, vbicq_u16(vdupq_n_u16(0x1000), m));
+
+  // high byte of each lane selects 0xff, which makes tbl output zero
+  const uint16x8_t index = vandq_u16(vshrq_n_u16(x, 8), vdupq_n_u16(0xf));
+  const uint8x16_t sel =
+      vreinterpretq_u8_u16(vorrq_u16(index, vdupq_n_u16(0xff00)));
+  const uint16x8_t base =
+      vreinterpretq_u16_u8(vqtbl1q_u8(vld1q_u8(U16LOG2_BASE), sel));
+  const uint16x8_t slope =
+      vreinterpretq_u16_u8(vqtbl1q_u8(vld1q_u8(U16LOG2_SLOPE), sel));
+  const uint16x8_t q = vandq_u16(x, vdupq_n_u16(0xff));
+
+  ret = vaddq_u16(ret, vshlq_n_u16(base, 4));
+  ret = vaddq_u16(ret, vshrq_n_u16(vmulq_u16(slope, q), 4));
+  return vbicq_u16(ret, zero_mask);
+}
+
+void u16log2_block(const uint16_t *src, uint16_t *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    vst1q_u16(dst + i, u16log2_x8(vld1q_u16(src + i)));
+  }
+  for (; i < n; i++) {
+    dst[i] = u16log2(src[i]);
+  }
+}
+
+#else
+
+void u16log2_block(const uint16_t *src, uint16_t *dst, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = u16log2(src[i]);
+  }
+}
+
+#endif
+
+#endif
+
+}  // namespace vlcfg
+
+#endif
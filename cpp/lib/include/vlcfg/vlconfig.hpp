@@ -1,6 +1,9 @@
 #ifndef VLCFG_VLCONFIG_HPP
 #define VLCFG_VLCONFIG_HPP
 
+#include "vlcfg/multi_lane_receiver.hpp"
+#include "vlcfg/packed_receiver.hpp"
 #include "vlcfg/receiver.hpp"
+#include "vlcfg/rx_filter.hpp"
 
 #endif
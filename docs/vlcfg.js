@@ -2,11 +2,37 @@
 
 const RE_IPV4_ADDR = /^(\d{1,3})\.(\d{1,3})\.(\d{1,3})\.(\d{1,3})$/;
 
+const DEFAULT_BAUDRATE = 10;
+const DEFAULT_PREAMBLE = 7;
+const FRAME_MEASURE_COUNT = 30;
+// bit period error the default receiver CDR follows
+const FRAME_LOCK_TOLERANCE = 0.02;
+const DEFAULT_FEC_DEPTH = 4;
+const DEFAULT_FEC_PARITY = 4;
+const MAX_FEC_DEPTH = 8;
+const MAX_FEC_PARITY = 15;
+const FEC_DATA_LEN = 32;
+const FEC_HEADER_COPIES = 3;
+const MAX_LANES = 4;
+const MAX_COLOR_LANES = 3;
+const PAM4_TRAIN_SYMBOLS = 8;
+const MAX_RATE_MUL = 8;
+const RATE_PREAMBLE = 4;
+// first byte of a segment frame, the CBOR break code
+const SEGMENT_MARKER = 0xff;
+const MAX_SEGMENTS = 255;
+// drive values of the PAM-4 levels, 0, 1/3, 2/3 and full luminance after the
+// sRGB gamma
+const PAM4_LEVELS = [0, 155, 212, 255];
+
 const SYMBOL_BITS = 5;
 const SYMBOL_CONTROL = 0b01010;
 const SYMBOL_SYNC = 0b10001;
 const SYMBOL_SOF = 0b00011;
 const SYMBOL_EOF = 0b00111;
+const SYMBOL_SOF_FEC = 0b11011;
+const SYMBOL_PAM4 = 0b11101;
+const SYMBOL_RATE = 0b10111;
 const SYMBOL_TABLE = [
   0b00101, 0b00110, 0b01001, 0b01011,
   0b01100, 0b01101, 0b01110, 0b10010,
@@ -14,6 +40,53 @@ const SYMBOL_TABLE = [
   0b11000, 0b11001, 0b11010, 0b11100
 ];
 
+// 8b/9b codewords: the first 256 9 bit words in ascending order whose runs
+// are up to 2 bits at both ends and up to 4 bits inside
+const CODE_8B9B_TABLE = [];
+for (let w = 0; w < 512 && CODE_8B9B_TABLE.length < 256; w++) {
+  let run = 1, first = 0, longest = 1;
+  for (let i = 1; i < 9; i++) {
+    if (((w >> i) & 1) === ((w >> (i - 1)) & 1)) {
+      run++;
+    }
+    else {
+      if (first === 0) first = run;
+      run = 1;
+    }
+    longest = Math.max(longest, run);
+  }
+  if (first === 0) first = run;
+  if (first <= 2 && run <= 2 && longest <= 4) {
+    CODE_8B9B_TABLE.push(w);
+  }
+}
+
+// the line codes, must match the one of the receiver
+const LINE_CODES = {
+  '4b5b': {
+    id: 0,
+    bits: SYMBOL_BITS * 2,
+    encode: (byte) => (SYMBOL_TABLE[byte >> 4] << SYMBOL_BITS) | SYMBOL_TABLE[byte & 0x0F],
+    sync: (SYMBOL_CONTROL << SYMBOL_BITS) | SYMBOL_SYNC,
+    sof: (SYMBOL_CONTROL << SYMBOL_BITS) | SYMBOL_SOF,
+    sofFec: (SYMBOL_CONTROL << SYMBOL_BITS) | SYMBOL_SOF_FEC,
+    eof: (SYMBOL_CONTROL << SYMBOL_BITS) | SYMBOL_EOF,
+    pam4: (SYMBOL_CONTROL << SYMBOL_BITS) | SYMBOL_PAM4,
+    rate: (SYMBOL_CONTROL << SYMBOL_BITS) | SYMBOL_RATE,
+  },
+  '8b9b': {
+    id: 1,
+    bits: 9,
+    encode: (byte) => CODE_8B9B_TABLE[byte],
+    sync: 0b100000101,
+    sof: 0b010000011,
+    sofFec: 0b001111101,
+    eof: 0b011111010,
+    pam4: 0b101111100,
+    rate: 0b000111110,
+  },
+};
+
 export class Types {
   static TEXT = 't';
   static PASS = 'p';
@@ -44,6 +117,17 @@ export function makeFromUrlHash(hash) {
 
   replaceKey(formJson, 't', 'title');
   replaceKey(formJson, 'e', 'entries');
+  replaceKey(formJson, 'b', 'baudrate');
+  replaceKey(formJson, 'pr', 'preamble');
+  replaceKey(formJson, 'fl', 'frameLock');
+  replaceKey(formJson, 'fe', 'fec');
+  replaceKey(formJson, 'fd', 'fecDepth');
+  replaceKey(formJson, 'ln', 'lanes');
+  replaceKey(formJson, 'lc', 'laneColor');
+  replaceKey(formJson, 'pm', 'pam4');
+  replaceKey(formJson, 'co', 'lineCode');
+  replaceKey(formJson, 'dr', 'dualRate');
+  replaceKey(formJson, 'sg', 'segmentSize');
   for (const entry of formJson.entries) {
     replaceKey(entry, 'k', 'key');
     replaceKey(entry, 't', 'type');
@@ -92,9 +176,30 @@ export class VlcfgForm {
 
   entries = [];
 
-  sendingSequence = null;
+  lamps = [this.lamp];
+  numLanes = 1;
+  laneColor = false;
+
+  sendingSequences = null;
   nextBitPos = 0;
   nextBitTime = 0;
+  bitPeriodMs = 1000 / DEFAULT_BAUDRATE;
+  preambleLength = DEFAULT_PREAMBLE;
+  frameLock = false;
+  frameLocked = false;
+  fecParity = 0;
+  fecDepth = DEFAULT_FEC_DEPTH;
+  pam4 = false;
+  lineCode = LINE_CODES['4b5b'];
+  rateMul = 1;
+  segmentSize = 0;
+  carousel = false;
+  tickPeriodMs = 1000 / DEFAULT_BAUDRATE;
+  framePeriodMs = 0;
+  framesPerBit = 1;
+  frameCount = 0;
+  nextBitFrame = 0;
+  lastFrameTime = 0;
   wakeLock = null;
 
   /**
@@ -105,6 +210,110 @@ export class VlcfgForm {
       this.header.textContent = formJson.title;
     }
 
+    if (formJson.baudrate) {
+      const baudrate = Number(formJson.baudrate);
+      if (!(baudrate > 0)) {
+        throw new Error("Invalid baudrate: " + formJson.baudrate);
+      }
+      this.bitPeriodMs = 1000 / baudrate;
+    }
+
+    if (formJson.preamble) {
+      const preamble = Number(formJson.preamble);
+      if (!(Number.isInteger(preamble) && preamble >= 2)) {
+        throw new Error("Invalid preamble length: " + formJson.preamble);
+      }
+      this.preambleLength = preamble;
+    }
+
+    if (formJson.frameLock) {
+      this.frameLock = true;
+    }
+
+    if (formJson.fec) {
+      // `true` or 1 selects the default parity length
+      let parity = Number(formJson.fec);
+      if (parity === 1) {
+        parity = DEFAULT_FEC_PARITY;
+      }
+      if (!(Number.isInteger(parity) && 2 <= parity && parity <= MAX_FEC_PARITY)) {
+        throw new Error("Invalid FEC parity length: " + formJson.fec);
+      }
+      this.fecParity = parity;
+    }
+
+    if (formJson.lanes) {
+      const lanes = Number(formJson.lanes);
+      if (!(Number.isInteger(lanes) && 1 <= lanes && lanes <= MAX_LANES)) {
+        throw new Error("Invalid number of lanes: " + formJson.lanes);
+      }
+      this.numLanes = lanes;
+    }
+
+    if (formJson.laneColor) {
+      // the lanes are sent on the R, G and B channels of a single lamp
+      if (this.numLanes > MAX_COLOR_LANES) {
+        throw new Error("Too many lanes for color channels: " + this.numLanes);
+      }
+      this.laneColor = true;
+    }
+    else {
+      for (let i = 1; i < this.numLanes; i++) {
+        const lamp = makeDiv([], "vlcfg_lamp");
+        this.lamps[i - 1].after(lamp);
+        this.lamps.push(lamp);
+      }
+      if (this.numLanes > 1) {
+        for (const lamp of this.lamps) {
+          lamp.classList.add("vlcfg_lamp_multi");
+        }
+      }
+    }
+
+    if (formJson.fecDepth) {
+      const depth = Number(formJson.fecDepth);
+      if (!(Number.isInteger(depth) && 1 <= depth && depth <= MAX_FEC_DEPTH)) {
+        throw new Error("Invalid FEC depth: " + formJson.fecDepth);
+      }
+      this.fecDepth = depth;
+    }
+
+    if (formJson.lineCode) {
+      if (!(formJson.lineCode in LINE_CODES)) {
+        throw new Error("Invalid line code: " + formJson.lineCode);
+      }
+      this.lineCode = LINE_CODES[formJson.lineCode];
+    }
+
+    if (formJson.pam4) {
+      // the run length of the PAM-4 symbols is bounded for 4b/5b only
+      if (this.lineCode !== LINE_CODES['4b5b']) {
+        throw new Error("PAM-4 needs the 4b5b line code");
+      }
+      this.pam4 = true;
+    }
+
+    if (formJson.dualRate) {
+      // the payload is sent at `dualRate` times the baud rate
+      const mul = Number(formJson.dualRate);
+      if (!(Number.isInteger(mul) && 2 <= mul && mul <= MAX_RATE_MUL)) {
+        throw new Error("Invalid dual-rate multiplier: " + formJson.dualRate);
+      }
+      if (this.pam4) {
+        throw new Error("PAM-4 cannot be combined with dual-rate");
+      }
+      this.rateMul = mul;
+    }
+
+    if (formJson.segmentSize) {
+      // larger payloads are sent as a repeating carousel of segment frames
+      const size = Number(formJson.segmentSize);
+      if (!(Number.isInteger(size) && size >= 1)) {
+        throw new Error("Invalid segment size: " + formJson.segmentSize);
+      }
+      this.segmentSize = size;
+    }
+
     for (const entryJson of formJson.entries) {
       const entry = new FormEntry(entryJson);
       this.entries.push(entry);
@@ -150,20 +359,23 @@ export class VlcfgForm {
     }
     console.log("Payload: " + hexStr);
 
-    const seq = new LightSequence();
-    for (let i = 0; i < 7; i++) {
-      seq.pushSymbol(SYMBOL_CONTROL);
-      seq.pushSymbol(SYMBOL_SYNC);
+    let bodies = [payload];
+    this.carousel = false;
+    if (this.segmentSize > 0 && payload.length > this.segmentSize) {
+      bodies = segmentPayload(payload, this.segmentSize);
+      this.carousel = true;
+      console.log("Segments: " + bodies.length);
     }
-    seq.pushSymbol(SYMBOL_CONTROL);
-    seq.pushSymbol(SYMBOL_SOF);
-    for (const byte of payload) {
-      seq.pushByte(byte);
+
+    const seqs = [];
+    for (let lane = 0; lane < this.numLanes; lane++) {
+      seqs.push(new LightSequence(this.lineCode, this.rateMul));
+    }
+    for (const body of bodies) {
+      this.pushFrame(seqs, body);
     }
-    seq.pushSymbol(SYMBOL_CONTROL);
-    seq.pushSymbol(SYMBOL_EOF);
-    seq.pushSymbol(SYMBOL_CONTROL);
-    seq.pushSymbol(SYMBOL_SYNC);
+
+    this.tickPeriodMs = this.bitPeriodMs / this.rateMul;
 
     this.submitButton.disabled = true;
     this.cancelButton.disabled = false;
@@ -172,10 +384,38 @@ export class VlcfgForm {
       fade(elm, false, 500);
     }
 
-    this.sendingSequence = seq;
+    this.frameLocked = false;
+    if (this.frameLock) {
+      // lock the bit period to whole display refreshes, unless that changes
+      // the baud rate more than a receiver can follow
+      this.framePeriodMs = await measureFramePeriod(FRAME_MEASURE_COUNT);
+      this.framesPerBit =
+        Math.max(1, Math.round(this.tickPeriodMs / this.framePeriodMs));
+      const lockedMs = this.framesPerBit * this.framePeriodMs;
+      const error = Math.abs(lockedMs - this.tickPeriodMs) / this.tickPeriodMs;
+      console.log("Frame period: " + this.framePeriodMs.toFixed(2) +
+        " ms, " + this.framesPerBit + " frames/bit");
+      if (error > FRAME_LOCK_TOLERANCE) {
+        console.warn("Frame lock disabled: " + lockedMs.toFixed(2) +
+          " ms per bit instead of " + this.tickPeriodMs.toFixed(2) + " ms");
+      }
+      else {
+        this.frameLocked = true;
+      }
+      this.frameCount = 0;
+      this.nextBitFrame = 0;
+      this.lastFrameTime = performance.now();
+    }
+
+    this.sendingSequences = seqs;
     this.nextBitPos = 0;
     this.nextBitTime = performance.now() + 100;
-    this.animate(performance.now());
+    if (this.frameLocked) {
+      requestAnimationFrame(now => this.animate(now));
+    }
+    else {
+      this.animate(performance.now());
+    }
 
     try {
       if ('wakeLock' in navigator) {
@@ -187,22 +427,113 @@ export class VlcfgForm {
     }
   }
 
+  /**
+   * Appends a frame carrying `payload` to the sequence of each lane.
+   * @param {Array<LightSequence>} seqs
+   * @param {Array<number>} payload
+   */
+  pushFrame(seqs, payload) {
+    const code = this.lineCode;
+    let sof = code.sof;
+    if (this.fecParity > 0) {
+      sof = code.sofFec;
+      payload = fecEncode(payload, this.fecDepth, this.fecParity);
+    }
+
+    // lane k carries every N-th byte starting from byte k, after a lane
+    // header (k << 4) | N
+    for (let lane = 0; lane < this.numLanes; lane++) {
+      const frame = new LightSequence(code);
+      frame.pushCodeword(sof);
+      let frameLen = 0;
+      if (this.numLanes > 1) {
+        frame.pushByte((lane << 4) | this.numLanes);
+        frameLen++;
+      }
+      for (let i = lane; i < payload.length; i += this.numLanes) {
+        frame.pushByte(payload[i]);
+        frameLen++;
+      }
+      frame.pushCodeword(code.eof);
+
+      // with dual-rate, a tick is a bit of the payload and the other bits
+      // last `rateMul` ticks
+      const seq = seqs[lane];
+      if (this.pam4) {
+        // the PAM-4 frame, then the binary one for the receivers that cannot
+        // resolve the levels
+        seq.pushPreamble(this.preambleLength);
+        seq.pushCodeword(code.pam4);
+        seq.pushPam4Frame(frame);
+      }
+      seq.pushPreamble(this.preambleLength);
+      if (this.rateMul > 1) {
+        // the rate header, then the frame after a short preamble at the
+        // payload rate
+        seq.pushCodeword(code.rate);
+        const header = [
+          (code.id << 4) | this.rateMul, (frameLen >> 8) & 0xff, frameLen & 0xff
+        ];
+        header.push(~(header[0] ^ header[1] ^ header[2]) & 0xff);
+        for (const byte of header) {
+          seq.pushByte(byte);
+        }
+        const fast = new LightSequence(code);
+        fast.pushPreamble(RATE_PREAMBLE);
+        seq.commands.push(...fast.commands);
+      }
+      seq.commands.push(...frame.commands);
+      seq.pushCodeword(code.sync);
+    }
+
+    // the shorter lanes hold the last level
+    const seqLen = Math.max(...seqs.map(seq => seq.commands.length));
+    for (const seq of seqs) {
+      const last = seq.commands[seq.commands.length - 1];
+      while (seq.commands.length < seqLen) {
+        seq.commands.push(last);
+      }
+    }
+  }
+
   animate(now) {
     let stop = false;
-    const seq = this.sendingSequence;
+    const seqs = this.sendingSequences;
+    const seq = seqs ? seqs[0] : null;
+
+    let bitDue = false;
+    if (seq && this.frameLocked) {
+      // count the refreshes including the dropped ones, so that the edges
+      // stay on the refresh grid
+      const elapsed = now - this.lastFrameTime;
+      this.frameCount += Math.max(1, Math.round(elapsed / this.framePeriodMs));
+      this.lastFrameTime = now;
+      if (this.frameCount >= this.nextBitFrame) {
+        this.nextBitFrame += this.framesPerBit;
+        bitDue = true;
+      }
+    }
+    else if (seq && now >= this.nextBitTime) {
+      this.nextBitTime += this.tickPeriodMs;
+      bitDue = true;
+    }
 
     if (!seq) {
       stop = false;
     }
-    else if (now >= this.nextBitTime) {
+    else if (bitDue) {
       const len = seq.commands.length;
-      const cmd = seq.commands[this.nextBitPos];
-      this.lamp.style.background = cmd.lampValue ? "white" : "black";
+      this.showLamps(seqs.map(s => s.commands[this.nextBitPos].lampValue));
       this.progress.value = (this.nextBitPos / len) * 100;
-      this.nextBitTime += 100;
       this.nextBitPos++;
       if (this.nextBitPos >= len) {
-        stop = true;
+        // the carousel repeats until cancelled
+        if (this.carousel) {
+          this.nextBitPos = 0;
+        }
+        else {
+          stop = true;
+        }
       }
     }
 
@@ -214,20 +545,41 @@ export class VlcfgForm {
     }
   }
 
+  /**
+   * @param {Array<number>} values lamp value (0 to 255) of each lane
+   */
+  showLamps(values) {
+    if (this.laneColor) {
+      const rgb = [0, 0, 0];
+      for (let i = 0; i < values.length; i++) {
+        rgb[i] = values[i];
+      }
+      this.lamp.style.background = `rgb(${rgb[0]}, ${rgb[1]}, ${rgb[2]})`;
+    }
+    else {
+      for (let i = 0; i < values.length; i++) {
+        const v = values[i];
+        this.lamps[i].style.background = `rgb(${v}, ${v}, ${v})`;
+      }
+    }
+  }
+
   cancel() {
     this.progress.value = 0;
     this.reset();
   }
 
   reset() {
-    this.lamp.style.background = "#888";
+    for (const lamp of this.lamps) {
+      lamp.style.background = "#888";
+    }
     for (const elm of this.elementsToBeHidden) {
       //elm.style.visibility = "visible";
       fade(elm, true, 500);
     }
     this.submitButton.disabled = false;
     this.cancelButton.disabled = true;
-    this.sendingSequence = null;
+    this.sendingSequences = null;
 
     if (this.wakeLock) {
       this.wakeLock.release().then(() => {
@@ -255,6 +607,32 @@ export class VlcfgForm {
   }
 }
 
+/**
+ * Measures the display refresh period with requestAnimationFrame().
+ * @param {number} count
+ * @returns {Promise<number>} median of the frame intervals in milliseconds
+ */
+function measureFramePeriod(count) {
+  return new Promise(resolve => {
+    const intervals = [];
+    let last = -1;
+    const step = (now) => {
+      if (last >= 0) {
+        intervals.push(now - last);
+      }
+      last = now;
+      if (intervals.length < count) {
+        requestAnimationFrame(step);
+      }
+      else {
+        intervals.sort((a, b) => a - b);
+        resolve(intervals[Math.floor(count / 2)]);
+      }
+    };
+    requestAnimationFrame(step);
+  });
+}
+
 class LightCommand {
   /** @type {number} */
   lampValue;
@@ -262,7 +640,7 @@ class LightCommand {
   delayTime;
 
   /**
-   * @param {number} lampValue 
+   * @param {number} lampValue drive value of the lamp, 0 to 255
    * @param {number} delayTime 
    */
   constructor(lampValue, delayTime) {
@@ -275,11 +653,49 @@ class LightSequence {
   /** @type {Array<LightCommand>} */
   commands = [];
 
-  pushSymbol(symbol) {
-    for (let i = SYMBOL_BITS - 1; i >= 0; i--) {
-      const bit = (symbol >> i) & 1;
-      const cmd = new LightCommand(bit ? 1 : 0, 1);
-      this.commands.push(cmd);
+  /**
+   * @param {Object} lineCode entry of LINE_CODES
+   * @param {number} ticks number of commands per bit
+   */
+  constructor(lineCode = LINE_CODES['4b5b'], ticks = 1) {
+    this.lineCode = lineCode;
+    this.ticks = ticks;
+  }
+
+  pushCodeword(codeword) {
+    for (let i = this.lineCode.bits - 1; i >= 0; i--) {
+      const bit = (codeword >> i) & 1;
+      for (let j = 0; j < this.ticks; j++) {
+        this.commands.push(new LightCommand(bit ? 255 : 0, 1));
+      }
+    }
+  }
+
+  pushPreamble(length) {
+    for (let i = 0; i < length; i++) {
+      this.pushCodeword(this.lineCode.sync);
+    }
+  }
+
+  /**
+   * Sends the training levels and the binary `frame` in PAM-4, two bits per
+   * symbol. The first bit selects the inner levels (1, 2) or the outer ones
+   * (0, 3), and the second one toggles the upper and lower half.
+   * @param {LightSequence} frame
+   */
+  pushPam4Frame(frame) {
+    for (let i = 0; i < PAM4_TRAIN_SYMBOLS; i++) {
+      this.commands.push(new LightCommand(PAM4_LEVELS[(i & 1) ? 2 : 1], 1));
+    }
+    // the training ends in the upper half
+    let upper = true;
+    const bits = frame.commands.map(cmd => cmd.lampValue ? 1 : 0);
+    for (let i = 0; i + 1 < bits.length; i += 2) {
+      if (bits[i + 1]) {
+        upper = !upper;
+      }
+      const level = upper ? (bits[i] ? 2 : 3) : (bits[i] ? 1 : 0);
+      this.commands.push(new LightCommand(PAM4_LEVELS[level], 1));
     }
   }
 
@@ -287,8 +703,7 @@ class LightSequence {
     if (byte < 0 || byte > 255 || !Number.isInteger(byte)) {
       throw new Error("Byte out of range");
     }
-    this.pushSymbol(SYMBOL_TABLE[(byte >> 4) & 0x0F]);
-    this.pushSymbol(SYMBOL_TABLE[byte & 0x0F]);
+    this.pushCodeword(this.lineCode.encode(byte));
   }
 }
 
@@ -482,6 +897,120 @@ function crc32(byteArray) {
   return ~crc >>> 0;
 }
 
+const GF_EXP = new Array(512);
+const GF_LOG = new Array(256);
+{
+  let x = 1;
+  for (let i = 0; i < 255; i++) {
+    GF_EXP[i] = GF_EXP[i + 255] = x;
+    GF_LOG[x] = i;
+    x <<= 1;
+    if (x & 0x100) x ^= 0x11d;
+  }
+}
+
+function gfMul(a, b) {
+  if (a == 0 || b == 0) return 0;
+  return GF_EXP[GF_LOG[a] + GF_LOG[b]];
+}
+
+/**
+ * Reed-Solomon parity bytes of `msg`, with the generator polynomial
+ * (x - a^0)(x - a^1)...(x - a^(numParity-1)).
+ * @param {Array<number>} msg
+ * @param {number} numParity
+ * @returns {Array<number>}
+ */
+function rsParity(msg, numParity) {
+  // generator polynomial, the highest order term first
+  let gen = [1];
+  for (let i = 0; i < numParity; i++) {
+    const next = gen.concat([0]);
+    for (let j = 0; j < gen.length; j++) {
+      next[j + 1] ^= gfMul(gen[j], GF_EXP[i]);
+    }
+    gen = next;
+  }
+
+  const rem = new Array(numParity).fill(0);
+  for (const byte of msg) {
+    const f = byte ^ rem.shift();
+    rem.push(0);
+    for (let i = 0; i < numParity; i++) {
+      rem[i] ^= gfMul(gen[i + 1], f);
+    }
+  }
+  return rem;
+}
+
+/**
+ * Adds the FEC header and the Reed-Solomon parity. Byte t of each group
+ * belongs to codeword (t % depth), so that burst errors are spread over the
+ * codewords.
+ * @param {Array<number>} payload
+ * @param {number} depth
+ * @param {number} numParity
+ * @returns {Array<number>}
+ */
+function fecEncode(payload, depth, numParity) {
+  const out = [];
+  for (let i = 0; i < FEC_HEADER_COPIES; i++) {
+    out.push((depth << 4) | numParity);
+  }
+
+  const groupSize = depth * FEC_DATA_LEN;
+  for (let start = 0; start < payload.length; start += groupSize) {
+    const group = payload.slice(start, start + groupSize);
+    const codewords = [];
+    for (let j = 0; j < depth; j++) {
+      const data = [];
+      for (let i = j; i < group.length; i += depth) {
+        data.push(group[i]);
+      }
+      codewords.push(data.concat(rsParity(data, numParity)));
+    }
+
+    // the data bytes come first in order, then the parity bytes
+    const groupLen = group.length + depth * numParity;
+    for (let t = 0; t < groupLen; t++) {
+      out.push(codewords[t % depth][Math.floor(t / depth)]);
+    }
+  }
+  return out;
+}
+
+/**
+ * Splits the payload (CBOR object and CRC32) into segment frame bodies: the
+ * marker, the payload ID, the segment index and count, the payload length,
+ * the segment and the CRC32 of all these. The segments are ceil(length /
+ * count) bytes long, except the last one. The payload ID is the last byte of
+ * the payload CRC, which changes with the content.
+ * @param {Array<number>} payload
+ * @param {number} maxSize
+ * @returns {Array<Array<number>>}
+ */
+function segmentPayload(payload, maxSize) {
+  const len = payload.length;
+  if (len > 0xffff) {
+    throw new Error("Payload too large");
+  }
+  const count = Math.min(MAX_SEGMENTS, Math.ceil(len / maxSize));
+  const size = Math.ceil(len / count);
+  const id = payload[len - 1];
+  const bodies = [];
+  for (let i = 0; i < count; i++) {
+    const body = [SEGMENT_MARKER, id, i, count, (len >> 8) & 0xff, len & 0xff];
+    body.push(...payload.slice(i * size, (i + 1) * size));
+    const crc = crc32(body);
+    body.push(Math.floor(crc / 0x1000000) & 0xff);
+    body.push(Math.floor(crc / 0x10000) & 0xff);
+    body.push(Math.floor(crc / 0x100) & 0xff);
+    body.push(Math.floor(crc / 0x1) & 0xff);
+    bodies.push(body);
+  }
+  return bodies;
+}
+
 /**
  * @param {string | Node | Array<string | Node> | null} children
  * @param {boolean} center